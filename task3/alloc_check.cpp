@@ -0,0 +1,104 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+#include "server.hpp"
+#include "executor.hpp"
+
+
+// every global allocation in the program goes through here
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t a = static_cast<size_t>(align);
+    if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+
+double fun_pow(double x, double y) {
+    return std::pow(x, y);
+}
+
+
+client_task awaiting_client(server<double> &s, executor &exec, size_t n, double &sum) {
+    for (size_t i = 0; i < n; i++)
+        sum += co_await s.submit(Task<double>(i % 100, 2, fun_pow), {.keep_result = false}, &exec);
+}
+
+
+// Submits tasks through every result path (handle, request_result and
+// co_await) and checks that none of them allocates once the server is
+// running. Coroutine frames are allocated when they are created, before
+// the count starts.
+// usage: alloc_check [tasks]
+int main(int argc, char **argv) {
+    size_t n = 100000;
+    if (argc > 1)
+        n = std::stoul(argv[1]);
+
+    server<double> s(4, 1024);
+    s.start();
+
+    // a lambda with captures is stored inline as well
+    double scale = 0.5;
+    auto scaled_pow = [scale](double x, double y) { return scale * std::pow(x, y); };
+
+    double sum = 0.0;
+    size_t before = allocations.load();
+    for (size_t i = 0; i < n; i++) {
+        task_handle<double> handle = s.add_task_thread(Task<double>(i % 100, 2, fun_pow), {.keep_result = false});
+        sum += handle.get();
+
+        task_handle<double> polled = s.add_task_thread(Task<double>(i % 100, 2, scaled_pow));
+        double result;
+        result_status status;
+        while ((status = s.request_result(polled.id, result)) == RESULT_PENDING)
+            std::this_thread::yield();
+        if (status != RESULT_READY) {
+            std::cout << "result of task " << polled.id << " lost" << std::endl;
+            return 1;
+        }
+        sum += result;
+    }
+    size_t used = allocations.load() - before;
+
+    executor exec(100);
+    for (int c = 0; c < 100; c++)
+        exec.spawn(awaiting_client(s, exec, n / 100, sum));
+    before = allocations.load();
+    exec.run();
+    used += allocations.load() - before;
+
+    s.stop();
+
+    std::cout << 2 * n + n / 100 * 100 << " tasks, " << used << " heap allocations (checksum " << sum << ")" << std::endl;
+    return used == 0 ? 0 : 1;
+}
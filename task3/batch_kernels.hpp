@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+// Array versions of the server's task functions: out[k] = f(x[k], y[k]).
+// A worker hands a whole group of same-function tasks to one call. sqrt
+// and sin have AVX2 bodies chosen at run time; pow has no vector version
+// here and only saves the per-task dispatch.
+
+typedef void (*batch_kernel)(const double *x, const double *y, double *out, size_t n);
+
+inline void batch_sqrt_scalar(const double *x, const double *, double *out, size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+        out[k] = std::sqrt(x[k]);
+}
+
+inline void batch_sin_scalar(const double *x, const double *, double *out, size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+        out[k] = std::sin(x[k]);
+}
+
+inline void batch_pow(const double *x, const double *y, double *out, size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+        out[k] = std::pow(x[k], y[k]);
+}
+
+__attribute__((target("avx2,fma"))) inline void batch_sqrt_avx2(const double *x, const double *, double *out,
+                                                                 size_t n)
+{
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4)
+        _mm256_storeu_pd(out + k, _mm256_sqrt_pd(_mm256_loadu_pd(x + k)));
+    for (; k < n; k++)
+        out[k] = std::sqrt(x[k]);
+}
+
+// sin(x) = (-1)^q * sin(r) with q = round(x / pi) and r = x - q * pi. pi is
+// split in three parts (Cody-Waite) so r stays exact for |x| up to ~1e9;
+// sin(r) on [-pi/2, pi/2] is the Taylor series to r^23 (error below 1e-17).
+// q is rounded with the 1.5 * 2^52 trick, which leaves its parity in the
+// lowest mantissa bit, and the sign flip is a xor of that bit.
+__attribute__((target("avx2,fma"))) inline __m256d sin_avx2(__m256d x)
+{
+    const __m256d shift = _mm256_set1_pd(0x1.8p52);
+    __m256d qd = _mm256_fmadd_pd(x, _mm256_set1_pd(0.31830988618379067154), shift);
+    __m256i parity = _mm256_slli_epi64(_mm256_castpd_si256(qd), 63);
+    qd = _mm256_sub_pd(qd, shift);
+
+    __m256d r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(3.14159250259399414062), x);
+    r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(1.50995788317231927067e-7), r);
+    r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(1.0780605716316238e-14), r);
+
+    __m256d r2 = _mm256_mul_pd(r, r);
+    __m256d p = _mm256_set1_pd(1.0 / 25852016738884976640000.0);
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(-1.0 / 51090942171709440000.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(1.0 / 121645100408832000.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(-1.0 / 355687428096000.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(1.0 / 1307674368000.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(-1.0 / 6227020800.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(1.0 / 39916800.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(-1.0 / 362880.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(1.0 / 5040.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(-1.0 / 120.0));
+    p = _mm256_fmadd_pd(p, r2, _mm256_set1_pd(1.0 / 6.0));
+    // r - r^3 * p(r^2)
+    __m256d s = _mm256_fnmadd_pd(_mm256_mul_pd(r, r2), p, r);
+    return _mm256_xor_pd(s, _mm256_castsi256_pd(parity));
+}
+
+__attribute__((target("avx2,fma"))) inline void batch_sin_avx2(const double *x, const double *, double *out,
+                                                                size_t n)
+{
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4)
+        _mm256_storeu_pd(out + k, sin_avx2(_mm256_loadu_pd(x + k)));
+    if (k < n)
+    {
+        double tail[4] = {0.0, 0.0, 0.0, 0.0};
+        for (size_t j = k; j < n; j++)
+            tail[j - k] = x[j];
+        _mm256_storeu_pd(tail, sin_avx2(_mm256_loadu_pd(tail)));
+        for (size_t j = k; j < n; j++)
+            out[j] = tail[j - k];
+    }
+}
+
+inline bool cpu_has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+inline batch_kernel select_batch_sqrt()
+{
+    return cpu_has_avx2() ? batch_sqrt_avx2 : batch_sqrt_scalar;
+}
+
+inline batch_kernel select_batch_sin()
+{
+    return cpu_has_avx2() ? batch_sin_avx2 : batch_sin_scalar;
+}
@@ -1,60 +1,434 @@
 #include <iostream>
 #include <thread>
 #include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include "thread_pool.hpp"
+#include "dgemv_threads.hpp"
 
-void intialize_vector(int num_threads, std::vector<double> &vec)
+// columns per tile of the transposed product
+const size_t TILE_COLS = 2048;
+
+// batched product: rows per pool chunk, matrix columns per cache tile, and
+// the MR x NR block of results held in registers by the inner kernel
+const size_t BATCH_ROWS = 64;
+const size_t BATCH_COLS = 512;
+const size_t MR = 4, NR = 4;
+
+// timed calls per storage format, after one warm-up call
+const int COMPRESSED_REPEATS = 10;
+
+enum class Layout
 {
+    RowMajor,
+    ColMajor
+};
 
-    int chunck_size = vec.size() / num_threads;
-    std::vector<std::thread> threads;
+// k products with the same matrix as one matrix x panel product. The vectors
+// are packed into an N x kp panel (kp = k rounded up to NR), so every tile of
+// matrix rows is read once per batch instead of once per vector.
+std::vector<std::vector<double>> multiply_vectors_matrix(const std::vector<std::vector<double>> &vecs, const std::vector<double> &matrix, thread_pool &pool)
+{
+    size_t k = vecs.size();
+    size_t vec_size = k > 0 ? vecs[0].size() : 0;
+    size_t kp = (k + NR - 1) / NR * NR;
 
-    for (int i = 0; i < num_threads; i++)
+    std::vector<double> panel(vec_size * kp), out(vec_size * kp);
+    for (size_t c = 0; c < k; c++)
     {
-        int start = i * chunck_size, end = (i == num_threads - 1) ? vec.size() : (i + 1) * chunck_size;
-        threads.emplace_back([start, end, &vec]()
-                             {
-            for (int j = start; j < end; ++j) {
-                vec[j] = 1;
-            } });
+        for (size_t j = 0; j < vec_size; j++)
+        {
+            panel[j * kp + c] = vecs[c][j];
+        }
     }
 
-    for (auto &thread : threads)
+    pool.parallel_for(0, vec_size, BATCH_ROWS, [&matrix, &panel, &out, vec_size, kp](size_t start, size_t end)
+                      {
+                          for (size_t jb = 0; jb < vec_size; jb += BATCH_COLS)
+                          {
+                              size_t je = std::min(jb + BATCH_COLS, vec_size);
+                              for (size_t i = start; i < end; i += MR)
+                              {
+                                  size_t mr = std::min(MR, end - i);
+                                  const double *rows[MR];
+                                  for (size_t r = 0; r < MR; r++)
+                                  {
+                                      // rows past the end repeat the last one and are not stored
+                                      rows[r] = &matrix[std::min(i + r, end - 1) * vec_size];
+                                  }
+                                  for (size_t c = 0; c < kp; c += NR)
+                                  {
+                                      double acc[MR][NR];
+                                      for (size_t r = 0; r < MR; r++)
+                                      {
+                                          for (size_t q = 0; q < NR; q++)
+                                          {
+                                              acc[r][q] = (jb == 0 || r >= mr) ? 0.0 : out[(i + r) * kp + c + q];
+                                          }
+                                      }
+                                      for (size_t j = jb; j < je; j++)
+                                      {
+                                          const double *x = &panel[j * kp + c];
+                                          for (size_t r = 0; r < MR; r++)
+                                          {
+                                              double a = rows[r][j];
+                                              for (size_t q = 0; q < NR; q++)
+                                              {
+                                                  acc[r][q] += a * x[q];
+                                              }
+                                          }
+                                      }
+                                      for (size_t r = 0; r < mr; r++)
+                                      {
+                                          for (size_t q = 0; q < NR; q++)
+                                          {
+                                              out[(i + r) * kp + c + q] = acc[r][q];
+                                          }
+                                      }
+                                  }
+                              }
+                          }
+                      });
+
+    std::vector<std::vector<double>> result(k, std::vector<double>(vec_size));
+    for (size_t i = 0; i < vec_size; i++)
     {
-        thread.join();
+        for (size_t c = 0; c < k; c++)
+        {
+            result[c][i] = out[i * kp + c];
+        }
     }
+    return result;
 }
 
-std::vector<double> multiply_vector_matrix(const std::vector<double> &vec, const std::vector<double> &matrix, int num_threads)
+// result[j] = sum_i matrix[i * size + j] * vec[i]: rows are still streamed in
+// order. Each thread accumulates its rows into its own partial result tile by
+// tile, then the threads sum the partials, each over its own slice of result.
+std::vector<double> multiply_vector_matrix_axpy(const std::vector<double> &vec, const std::vector<double> &matrix, thread_pool &pool)
 {
-    int vec_size = vec.size();
+    size_t vec_size = vec.size();
     std::vector<double> result(vec_size);
+    // one row block, and so one partial result, per worker
+    size_t grain = (vec_size + pool.size() - 1) / pool.size();
+    std::vector<std::vector<double>> partial(pool.size());
+
+    pool.parallel_for(0, vec_size, grain, [grain, &vec, &matrix, &partial, vec_size](size_t start, size_t end)
+                      {
+                          std::vector<double> &local = partial[start / grain];
+                          local.assign(vec_size, 0.0);
+                          for (size_t jb = 0; jb < vec_size; jb += TILE_COLS)
+                          {
+                              size_t je = std::min(jb + TILE_COLS, vec_size);
+                              for (size_t i = start; i < end; ++i)
+                              {
+                                  const double *row = &matrix[i * vec_size];
+                                  for (size_t j = jb; j < je; ++j)
+                                  {
+                                      local[j] += row[j] * vec[i];
+                                  }
+                              }
+                          }
+                      });
+
+    pool.parallel_for(0, vec_size, grain_size(vec_size, pool, TILE_COLS), [&partial, &result](size_t start, size_t end)
+                      {
+                          for (auto &local : partial)
+                          {
+                              if (local.empty())
+                              {
+                                  continue;
+                              }
+                              for (size_t j = start; j < end; ++j)
+                              {
+                                  result[j] += local[j];
+                              }
+                          }
+                      });
+
+    return result;
+}
+
+// Reduced-precision copy of a square matrix: fp32, bf16 (upper half of a
+// float) or int8 with one scale per row. Products expand each value to
+// double and accumulate in double. With S = double it holds the matrix as
+// is, the baseline for the same kernel.
+template <typename S>
+struct CompressedMatrix
+{
+    std::vector<S> data;
+    std::vector<double> scale;
+};
+
+inline double decode(double v) { return v; }
+inline double decode(float v) { return v; }
+inline double decode(int8_t v) { return v; }
+inline double decode(uint16_t v)
+{
+    uint32_t u = (uint32_t)v << 16;
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
 
-    std::vector<std::thread> threads;
-    int chunck_size = vec_size / num_threads;
+inline void encode(double v, float &out) { out = (float)v; }
+inline void encode(double v, uint16_t &out)
+{
+    float f = (float)v;
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    u += 0x7fff + ((u >> 16) & 1);
+    out = (uint16_t)(u >> 16);
+}
 
-    for (int i = 0; i < num_threads; i++)
+template <typename S>
+CompressedMatrix<S> compress_matrix(const std::vector<double> &matrix, int size)
+{
+    CompressedMatrix<S> res;
+    res.data.resize(matrix.size());
+    if constexpr (std::is_same_v<S, int8_t>)
     {
-        int start = i * chunck_size, end = (i == num_threads - 1) ? vec_size : (i + 1) * chunck_size ;
-        threads.emplace_back([start, end, &vec, &matrix, &result, vec_size]()
-                             {
-                                 for (int i = start; i < end; ++i)
-                                 {
-                                     for (int j = 0; j < vec_size; ++j)
-                                     {
-                                         result[i] += vec[j] * matrix[i * vec_size + j];
-                                     }
-                                 }
-                             });
+        res.scale.resize(size);
+        for (int i = 0; i < size; i++)
+        {
+            double max_abs = 0;
+            for (int j = 0; j < size; j++)
+            {
+                max_abs = std::max(max_abs, std::abs(matrix[(size_t)i * size + j]));
+            }
+            res.scale[i] = max_abs > 0 ? max_abs / 127 : 1;
+            for (int j = 0; j < size; j++)
+            {
+                res.data[(size_t)i * size + j] = (int8_t)std::lrint(matrix[(size_t)i * size + j] / res.scale[i]);
+            }
+        }
     }
-
-    for (auto &thread : threads)
+    else
     {
-        thread.join();
+        for (size_t k = 0; k < matrix.size(); k++)
+        {
+            encode(matrix[k], res.data[k]);
+        }
     }
+    return res;
+}
+
+template <typename S>
+std::vector<double> multiply_vector_matrix_compressed(const std::vector<double> &vec, const CompressedMatrix<S> &matrix, thread_pool &pool)
+{
+    size_t vec_size = vec.size();
+    std::vector<double> result(vec_size);
+
+    pool.parallel_for(0, vec_size, grain_size(vec_size, pool, 1), [&vec, &matrix, &result, vec_size](size_t start, size_t end)
+                      {
+                          for (size_t i = start; i < end; ++i)
+                          {
+                              const S *row = &matrix.data[i * vec_size];
+                              double sum = 0;
+                              for (size_t j = 0; j < vec_size; ++j)
+                              {
+                                  sum += decode(row[j]) * vec[j];
+                              }
+                              result[i] = matrix.scale.empty() ? sum : sum * matrix.scale[i];
+                          }
+                      });
 
     return result;
 }
 
+// Seconds per product, averaged over COMPRESSED_REPEATS calls after a
+// warm-up call that also faults in the result; res is the last result.
+template <typename S>
+double time_compressed(const std::vector<double> &vec, const CompressedMatrix<S> &matrix, thread_pool &pool,
+                       std::vector<double> &res)
+{
+    res = multiply_vector_matrix_compressed(vec, matrix, pool);
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < COMPRESSED_REPEATS; r++)
+    {
+        res = multiply_vector_matrix_compressed(vec, matrix, pool);
+    }
+    std::chrono::duration<double> execution_time = std::chrono::high_resolution_clock::now() - start_time;
+    return execution_time.count() / COMPRESSED_REPEATS;
+}
+
+template <typename S>
+void run_compressed_format(const std::string &name, const std::vector<double> &vec, const std::vector<double> &matrix,
+                           const std::vector<double> &ref, double ref_time, thread_pool &pool)
+{
+    CompressedMatrix<S> small = compress_matrix<S>(matrix, vec.size());
+
+    std::vector<double> res;
+    double time = time_compressed(vec, small, pool, res);
+
+    double max_err = 0;
+    for (size_t i = 0; i < res.size(); i++)
+    {
+        max_err = std::max(max_err, std::abs(res[i] - ref[i]) / std::max(std::abs(ref[i]), 1e-300));
+    }
+    std::cout << name << ": " << time << " sec, speedup " << ref_time / time << ", max relative error " << max_err
+              << std::endl;
+}
+
+// Double product against fp32, bf16 and int8 storage of the same matrix.
+// All of them go through the same kernel, which sums each row in a
+// register, so only the storage differs.
+void run_compressed(int N, thread_pool &pool)
+{
+    CompressedMatrix<double> full;
+    std::vector<double> vec(N);
+    full.data.resize((size_t)N * N);
+    for (int i = 0; i < N; i++)
+    {
+        vec[i] = i;
+        for (int j = 0; j < N; j++)
+        {
+            full.data[(size_t)i * N + j] = i + j;
+        }
+    }
+
+    std::vector<double> ref;
+    double ref_time = time_compressed(vec, full, pool, ref);
+    std::cout << "fp64: " << ref_time << " sec" << std::endl;
+
+    run_compressed_format<float>("fp32", vec, full.data, ref, ref_time, pool);
+    run_compressed_format<uint16_t>("bf16", vec, full.data, ref, ref_time, pool);
+    run_compressed_format<int8_t>("int8", vec, full.data, ref, ref_time, pool);
+}
+
+// matrix * vec or matrix^T * vec in either layout. A column-major matrix is
+// the row-major transpose, so every case is either the row-wise dot product
+// or the tiled axpy traversal.
+std::vector<double> gemv(const std::vector<double> &vec, const std::vector<double> &matrix, Layout layout, bool transposed, thread_pool &pool)
+{
+    if ((layout == Layout::RowMajor) != transposed)
+    {
+        return multiply_vector_matrix(vec, matrix, pool);
+    }
+    return multiply_vector_matrix_axpy(vec, matrix, pool);
+}
+
+// Times all four layout / transpose combinations against a serial reference.
+void run_transposed(int N, thread_pool &pool)
+{
+    std::vector<double> row_major((size_t)N * N), col_major((size_t)N * N), vec(N);
+    for (int i = 0; i < N; i++)
+    {
+        vec[i] = i % 5;
+        for (int j = 0; j < N; j++)
+        {
+            row_major[(size_t)i * N + j] = (i + 3 * j) % 17;
+            col_major[(size_t)j * N + i] = (i + 3 * j) % 17;
+        }
+    }
+
+    for (Layout layout : {Layout::RowMajor, Layout::ColMajor})
+    {
+        for (bool transposed : {false, true})
+        {
+            std::vector<double> ref(N);
+            for (int i = 0; i < N; i++)
+            {
+                for (int j = 0; j < N; j++)
+                {
+                    ref[i] += (transposed ? row_major[(size_t)j * N + i] : row_major[(size_t)i * N + j]) * vec[j];
+                }
+            }
+
+            auto start_time = std::chrono::high_resolution_clock::now();
+            std::vector<double> res = gemv(vec, layout == Layout::RowMajor ? row_major : col_major, layout, transposed, pool);
+            std::chrono::duration<double> execution_time = std::chrono::high_resolution_clock::now() - start_time;
+
+            double max_err = 0;
+            for (int i = 0; i < N; i++)
+            {
+                max_err = std::max(max_err, std::abs(res[i] - ref[i]));
+            }
+            std::cout << (layout == Layout::RowMajor ? "row-major " : "col-major ") << (transposed ? "A^T*x: " : "A*x: ")
+                      << execution_time.count() << " sec, " << sizeof(double) * N * (double)N / execution_time.count() * 1e-9
+                      << " GB/s, max error " << max_err << std::endl;
+        }
+    }
+}
+
+// Repeated-call throughput of the pool against spawning threads per call,
+// both with num_threads threads (the pool counts the caller). The data is
+// initialized once, outside the timed loops.
+void run_pool_benchmark(int num_threads, thread_pool &pool)
+{
+    const int repeats = 50;
+    for (int N = 1000; N <= 5000; N += 1000)
+    {
+        std::vector<double> vec(N), matrix((size_t)N * N);
+        intialize_vector(pool, vec);
+        intialize_vector(pool, matrix);
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < repeats; r++)
+        {
+            multiply_vector_matrix_spawn(vec, matrix, num_threads);
+        }
+        std::chrono::duration<double> spawn_time = std::chrono::high_resolution_clock::now() - start_time;
+
+        start_time = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < repeats; r++)
+        {
+            multiply_vector_matrix(vec, matrix, pool);
+        }
+        std::chrono::duration<double> pool_time = std::chrono::high_resolution_clock::now() - start_time;
+
+        std::cout << "N=" << N << ": spawn " << repeats / spawn_time.count() << " calls/s, pool "
+                  << repeats / pool_time.count() << " calls/s, speedup " << spawn_time.count() / pool_time.count()
+                  << std::endl;
+    }
+}
+
+// k single products against one batched call, reported as vectors per second.
+void run_batch(int N, int k, thread_pool &pool)
+{
+    std::vector<double> matrix((size_t)N * N);
+    std::vector<std::vector<double>> vecs(k, std::vector<double>(N));
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            matrix[(size_t)i * N + j] = (i + 3 * j) % 17;
+        }
+        for (int c = 0; c < k; c++)
+        {
+            vecs[c][i] = (i + c) % 5;
+        }
+    }
+
+    std::vector<std::vector<double>> single(k);
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int c = 0; c < k; c++)
+    {
+        single[c] = multiply_vector_matrix(vecs[c], matrix, pool);
+    }
+    std::chrono::duration<double> single_time = std::chrono::high_resolution_clock::now() - start_time;
+
+    start_time = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<double>> batched = multiply_vectors_matrix(vecs, matrix, pool);
+    std::chrono::duration<double> batch_time = std::chrono::high_resolution_clock::now() - start_time;
+
+    double max_err = 0;
+    for (int c = 0; c < k; c++)
+    {
+        for (int i = 0; i < N; i++)
+        {
+            max_err = std::max(max_err, std::abs(batched[c][i] - single[c][i]));
+        }
+    }
+    std::cout << "single: " << k / single_time.count() << " vectors/s, batched: " << k / batch_time.count()
+              << " vectors/s, speedup " << single_time.count() / batch_time.count() << ", max error " << max_err
+              << std::endl;
+}
+
 int main(int argc, char **argv)
 {
 
@@ -70,17 +444,43 @@ int main(int argc, char **argv)
         num_threads = atoi(argv[2]);
     }
 
+    thread_pool pool(num_threads);
+
+    if (argc > 3 && std::string(argv[3]) == "pool")
+    {
+        run_pool_benchmark(num_threads, pool);
+        return 0;
+    }
+
+    if (argc > 3 && std::string(argv[3]) == "batch")
+    {
+        run_batch(N, argc > 4 ? atoi(argv[4]) : 16, pool);
+        return 0;
+    }
+
+    if (argc > 3 && std::string(argv[3]) == "trans")
+    {
+        run_transposed(N, pool);
+        return 0;
+    }
+
+    if (argc > 3 && std::string(argv[3]) == "compressed")
+    {
+        run_compressed(N, pool);
+        return 0;
+    }
+
 
     std::vector<double> vec(N);
-    intialize_vector(num_threads, vec);
+    intialize_vector(pool, vec);
 
-    std::vector<double> matrix(N * N);
-    intialize_vector(num_threads, matrix);
+    std::vector<double> matrix((size_t)N * N);
+    intialize_vector(pool, matrix);
 
     
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    std::vector<double> res = multiply_vector_matrix(vec, matrix, num_threads);
+    std::vector<double> res = multiply_vector_matrix(vec, matrix, pool);
 
     // for (int i = 0; i < res.size(); i++){
     //     std::cout << res[i] << " ";
@@ -0,0 +1,96 @@
+#pragma once
+
+// std::thread DGEMV, shared by dgemv.cpp and task_2/benchmark.cpp.
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "thread_pool.hpp"
+
+// spawn-per-call versions, kept as the baseline of the pool benchmark
+inline void intialize_vector_spawn(int num_threads, std::vector<double> &vec)
+{
+
+    int chunck_size = vec.size() / num_threads;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        int start = i * chunck_size, end = (i == num_threads - 1) ? vec.size() : (i + 1) * chunck_size;
+        threads.emplace_back([start, end, &vec]()
+                             {
+            for (int j = start; j < end; ++j) {
+                vec[j] = 1;
+            } });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+inline std::vector<double> multiply_vector_matrix_spawn(const std::vector<double> &vec, const std::vector<double> &matrix, int num_threads)
+{
+    int vec_size = vec.size();
+    std::vector<double> result(vec_size);
+
+    std::vector<std::thread> threads;
+    int chunck_size = vec_size / num_threads;
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        int start = i * chunck_size, end = (i == num_threads - 1) ? vec_size : (i + 1) * chunck_size ;
+        threads.emplace_back([start, end, &vec, &matrix, &result, vec_size]()
+                             {
+                                 for (int i = start; i < end; ++i)
+                                 {
+                                     for (int j = 0; j < vec_size; ++j)
+                                     {
+                                         result[i] += vec[j] * matrix[(size_t)i * vec_size + j];
+                                     }
+                                 }
+                             });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    return result;
+}
+
+// every worker gets a few chunks so that stealing can even out the load
+inline size_t grain_size(size_t size, const thread_pool &pool, size_t min_grain)
+{
+    return std::max(min_grain, size / (4 * pool.size()));
+}
+
+inline void intialize_vector(thread_pool &pool, std::vector<double> &vec)
+{
+    pool.parallel_for(0, vec.size(), grain_size(vec.size(), pool, 4096), [&vec](size_t start, size_t end)
+                      {
+            for (size_t j = start; j < end; ++j) {
+                vec[j] = 1;
+            } });
+}
+
+inline std::vector<double> multiply_vector_matrix(const std::vector<double> &vec, const std::vector<double> &matrix, thread_pool &pool)
+{
+    size_t vec_size = vec.size();
+    std::vector<double> result(vec_size);
+
+    pool.parallel_for(0, vec_size, grain_size(vec_size, pool, 1), [&vec, &matrix, &result, vec_size](size_t start, size_t end)
+                      {
+                          for (size_t i = start; i < end; ++i)
+                          {
+                              for (size_t j = 0; j < vec_size; ++j)
+                              {
+                                  result[i] += vec[j] * matrix[i * vec_size + j];
+                              }
+                          }
+                      });
+
+    return result;
+}
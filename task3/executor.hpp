@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <thread>
+#include "mpmc_queue.hpp"
+
+class executor;
+
+// A coroutine that nobody waits for, the frame is freed when it returns.
+// It starts suspended: executor::spawn runs it on the executor, start()
+// runs it on the calling thread up to its first co_await, after which it
+// continues on whichever thread resumes it.
+struct client_task
+{
+    struct promise_type
+    {
+        executor *owner = nullptr;
+
+        client_task get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept;
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+
+    void start() { handle.resume(); }
+};
+
+// Runs coroutines on the thread that calls run(). A coroutine that can
+// continue is posted to a ring, from any thread, and run() resumes them one
+// after another, sleeping while the ring is empty. run() returns once every
+// spawned coroutine has finished, so a spawned coroutine has to be resumed
+// through post() every time (server::submit with this executor), not on
+// another thread. The ring has to hold every coroutine that is alive at the
+// same time.
+class executor
+{
+private:
+    mpmc_queue<std::coroutine_handle<>> ready;
+    std::atomic<size_t> epoch{0};
+    std::atomic<size_t> live{0};
+
+    friend struct client_task::promise_type;
+
+public:
+    explicit executor(size_t capacity = 1 << 16) : ready(capacity) {}
+
+    void spawn(client_task task)
+    {
+        task.handle.promise().owner = this;
+        live.fetch_add(1);
+        post(task.handle);
+    }
+
+    void post(std::coroutine_handle<> handle)
+    {
+        while (!ready.try_push(handle))
+            std::this_thread::yield();
+        epoch.fetch_add(1);
+        epoch.notify_one();
+    }
+
+    void run()
+    {
+        while (live.load() > 0)
+        {
+            // as in the server: a post after the failed pop changes the epoch
+            size_t seen = epoch.load();
+            std::optional<std::coroutine_handle<>> next = ready.try_pop();
+            if (!next)
+            {
+                epoch.wait(seen);
+                continue;
+            }
+            next->resume();
+        }
+    }
+};
+
+inline std::suspend_never client_task::promise_type::final_suspend() noexcept
+{
+    // run() checks `live` only after resume() has returned, by then the
+    // frame is gone
+    if (owner)
+        owner->live.fetch_sub(1);
+    return {};
+}
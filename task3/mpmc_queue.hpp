@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+// Bounded multi-producer/multi-consumer ring (Vyukov). Every cell carries a
+// sequence number that tells whether it is free for the push with ticket
+// `pos` (seq == pos) or holds the element for the pop with ticket `pos`
+// (seq == pos + 1). A producer or consumer claims a ticket with one CAS on
+// its own counter and never touches the other side's counter, so pushes
+// and pops only contend among themselves.
+template <typename T>
+class mpmc_queue
+{
+private:
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T *item() { return std::launder(reinterpret_cast<T *>(storage)); }
+    };
+
+    std::unique_ptr<cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+
+public:
+    // capacity is rounded up to a power of two
+    explicit mpmc_queue(size_t capacity = 1 << 16)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        cells.reset(new cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ~mpmc_queue()
+    {
+        for (size_t pos = dequeue_pos.load(); pos != enqueue_pos.load(); pos++)
+            cells[pos & mask].item()->~T();
+    }
+
+    mpmc_queue(const mpmc_queue &) = delete;
+    mpmc_queue &operator=(const mpmc_queue &) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    // returns false if the queue is full
+    template <typename U>
+    bool try_push(U &&value)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &cells[pos & mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+        new (c->storage) T(std::forward<U>(value));
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // empty optional if the queue is empty
+    std::optional<T> try_pop()
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &cells[pos & mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return std::nullopt;
+            else
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+        T *item = c->item();
+        std::optional<T> out(std::move(*item));
+        item->~T();
+        // free for the push one lap later
+        c->seq.store(pos + mask + 1, std::memory_order_release);
+        return out;
+    }
+
+    // Pushes all n values with one CAS on the enqueue counter, or nothing
+    // (returns false) if fewer than n cells are free. The n cells are
+    // consecutive and were checked before the claim; nobody else can take
+    // them without moving the counter first.
+    template <typename U>
+    bool try_push_n(const U *values, size_t n)
+    {
+        if (n == 0)
+            return true;
+        if (n > capacity())
+            return false;
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            size_t i = 0;
+            for (; i < n; i++)
+            {
+                if (cells[(pos + i) & mask].seq.load(std::memory_order_acquire) != pos + i)
+                    break;
+            }
+            if (i < n)
+            {
+                size_t now = enqueue_pos.load(std::memory_order_relaxed);
+                if (now == pos)
+                    return false; // not enough free cells
+                pos = now;
+                continue;
+            }
+            if (enqueue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                break;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            cell &c = cells[(pos + i) & mask];
+            new (c.storage) T(values[i]);
+            c.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return true;
+    }
+
+    // Pops exactly n elements into out with one CAS on the dequeue counter,
+    // or nothing (returns false) if fewer than n are ready.
+    bool try_pop_n(T *out, size_t n)
+    {
+        if (n == 0)
+            return true;
+        if (n > capacity())
+            return false;
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            size_t i = 0;
+            for (; i < n; i++)
+            {
+                if (cells[(pos + i) & mask].seq.load(std::memory_order_acquire) != pos + i + 1)
+                    break;
+            }
+            if (i < n)
+            {
+                size_t now = dequeue_pos.load(std::memory_order_relaxed);
+                if (now == pos)
+                    return false; // not enough elements
+                pos = now;
+                continue;
+            }
+            if (dequeue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                break;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            cell &c = cells[(pos + i) & mask];
+            T *item = c.item();
+            out[i] = std::move(*item);
+            item->~T();
+            c.seq.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        return true;
+    }
+};
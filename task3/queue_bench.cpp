@@ -0,0 +1,100 @@
+#include <iostream>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <vector>
+#include <string>
+#include "mpmc_queue.hpp"
+
+
+// the queue server<T> used before: std::queue behind one mutex
+template<typename T>
+class mutex_queue {
+private:
+    std::queue<T> items;
+    std::mutex mut;
+
+public:
+    explicit mutex_queue(size_t) {}
+
+    bool try_push(T value) {
+        std::lock_guard<std::mutex> lock(mut);
+        items.push(std::move(value));
+        return true;
+    }
+
+    std::optional<T> try_pop() {
+        std::lock_guard<std::mutex> lock(mut);
+        if (items.empty())
+            return std::nullopt;
+        std::optional<T> out(std::move(items.front()));
+        items.pop();
+        return out;
+    }
+};
+
+
+// Every producer pushes its share of `total` items while `consumers` threads
+// pop until all of them are through. Returns items per second.
+template<typename Queue>
+double run_queue(size_t producers, size_t consumers, size_t total) {
+    Queue q(1 << 16);
+    std::atomic<size_t> popped{0};
+    std::atomic<bool> go{false};
+    size_t per_producer = total / producers;
+    total = per_producer * producers;
+
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++) {
+        threads.emplace_back([&, p]() {
+            while (!go)
+                std::this_thread::yield();
+            for (size_t i = 0; i < per_producer; i++) {
+                while (!q.try_push(p * per_producer + i))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (size_t c = 0; c < consumers; c++) {
+        threads.emplace_back([&]() {
+            while (!go)
+                std::this_thread::yield();
+            while (popped.load(std::memory_order_relaxed) < total) {
+                if (q.try_pop())
+                    popped.fetch_add(1, std::memory_order_relaxed);
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto &t : threads)
+        t.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return total / elapsed.count();
+}
+
+
+// usage: queue_bench [items] [consumers]
+int main(int argc, char **argv) {
+    size_t total = 1 << 20;
+    if (argc > 1)
+        total = std::stoul(argv[1]);
+    size_t consumers = 4;
+    if (argc > 2)
+        consumers = std::stoul(argv[2]);
+
+    std::cout << "producers\tmutex (items/s)\tlock-free (items/s)\tspeedup" << std::endl;
+    for (size_t producers = 1; producers <= 64; producers *= 2) {
+        double locked = run_queue<mutex_queue<size_t>>(producers, consumers, total);
+        double lock_free = run_queue<mpmc_queue<size_t>>(producers, consumers, total);
+        std::cout << producers << "\t" << locked << "\t" << lock_free << "\t" << lock_free / locked << std::endl;
+    }
+
+    return 0;
+}
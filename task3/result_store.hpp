@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// Results keyed by task id, split into shards with their own lock so a
+// lookup only waits for inserts that hash to the same shard. Consecutive
+// ids land in consecutive shards. Every shard is a ring allocated up front:
+// an id has a fixed place in it, so a result overwrites the one stored
+// `capacity` ids earlier and memory never grows. A result is removed when
+// it is read, and results older than `ttl` are never returned.
+
+enum result_status
+{
+    RESULT_PENDING, // not stored yet, ask again later
+    RESULT_READY,
+    RESULT_EVICTED, // taken already, overwritten by a newer id or expired
+    RESULT_UNKNOWN  // no task has this id
+};
+
+template <typename T>
+class result_store
+{
+private:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t NO_ID = SIZE_MAX;
+
+    struct entry
+    {
+        size_t id = NO_ID;
+        clock::time_point stored;
+        T value;
+        bool full = false;
+    };
+
+    struct shard
+    {
+        std::mutex mut;
+        std::unique_ptr<entry[]> entries;
+    };
+
+    std::unique_ptr<shard[]> shards;
+    size_t shard_bits = 0;
+    size_t shard_capacity;
+    clock::duration ttl;
+
+    entry &find(size_t id, shard *&sh)
+    {
+        sh = &shards[id & (((size_t)1 << shard_bits) - 1)];
+        return sh->entries[(id >> shard_bits) % shard_capacity];
+    }
+
+public:
+    // num_shards is rounded up to a power of two
+    explicit result_store(size_t capacity = 1 << 16, clock::duration time_to_live = std::chrono::seconds(60),
+                          size_t num_shards = 64)
+        : ttl(time_to_live)
+    {
+        while (((size_t)1 << shard_bits) < num_shards)
+            shard_bits++;
+        size_t size = (size_t)1 << shard_bits;
+        shard_capacity = (capacity + size - 1) / size;
+        if (shard_capacity == 0)
+            shard_capacity = 1;
+        shards.reset(new shard[size]);
+        for (size_t i = 0; i < size; i++)
+            shards[i].entries.reset(new entry[shard_capacity]);
+    }
+
+    void put(size_t id, T value)
+    {
+        shard *sh;
+        entry &e = find(id, sh);
+        clock::time_point now = clock::now();
+        std::lock_guard<std::mutex> lock(sh->mut);
+        // a worker may finish an id after the one that replaces it
+        if (e.id != NO_ID && e.id > id)
+            return;
+        e.id = id;
+        e.stored = now;
+        e.value = std::move(value);
+        e.full = true;
+    }
+
+    // Moves the result to `out` if it is ready and removes it from the
+    // store. An id has one place, so what is there tells the other cases
+    // apart: an older id (or nothing) means this one is still pending, a
+    // newer id means it was overwritten.
+    result_status take(size_t id, T &out)
+    {
+        shard *sh;
+        entry &e = find(id, sh);
+        std::lock_guard<std::mutex> lock(sh->mut);
+        if (e.id == NO_ID || e.id < id)
+            return RESULT_PENDING;
+        if (e.id > id || !e.full || clock::now() - e.stored >= ttl)
+            return RESULT_EVICTED;
+        e.full = false;
+        out = std::move(e.value);
+        return RESULT_READY;
+    }
+
+    // results that fit before the oldest is overwritten
+    size_t capacity() const { return shard_capacity << shard_bits; }
+
+    size_t size()
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < ((size_t)1 << shard_bits); i++)
+        {
+            std::lock_guard<std::mutex> lock(shards[i].mut);
+            for (size_t k = 0; k < shard_capacity; k++)
+                total += shards[i].entries[k].full;
+        }
+        return total;
+    }
+};
@@ -1,144 +1,348 @@
 #include <iostream>
-#include <queue>
-#include <future>
 #include <thread>
+#include <atomic>
 #include <cmath>
-#include <functional>
-#include <unordered_map>
-#include <mutex>
 #include <fstream>
+#include <algorithm>
+#include <optional>
+#include <chrono>
+#include <string>
+#include <span>
+#include <vector>
+#include "server.hpp"
+#include "batch_kernels.hpp"
+#include "executor.hpp"
 
 
 size_t N = 10000;
 
-template<typename T>
-class Task {
-private:
-    std::function<T(T, T)> _function;
+template <typename T>
+T fun_pow(T x, T y) {
+    return std::pow(x, y);
+}
 
-public:
-    size_t x, y;
-    Task(size_t _x, size_t _y, std::function<T(T, T)> function) : x(_x), y(_y), _function(function) {}
+template <typename T>
+T fun_sin(T x, T y) {
+    return std::sin(x);
+}
 
-    T execute_function() {
-        return _function(x, y);
-    }
+template <typename T>
+T fun_sqrt(T x, T y) {
+    return std::sqrt(x);
+}
 
-    std::function<T()> get_task_function() {
-        return [this]() { return this->execute_function(); };
-    }
-};
-
-
-template<typename T>
-class server {
-private:
-    std::queue<std::pair<size_t, std::packaged_task<T()>>> tasks;
-    std::unordered_map<size_t, T> results;
-    std::mutex mut;
-    std::thread serv_thr;
-    bool server_is_up = false;
-    size_t available_id = 0;
-
-    void server_thread() {
-        std::unique_lock<std::mutex> lock_res{mut, std::defer_lock};
-
-        while (server_is_up) {
-            lock_res.lock();
-
-            if (!tasks.empty()) {
-                auto task = std::move(tasks.front());
-                tasks.pop();
-                std::future<T> fut = task.second.get_future();
-                task.second();
-                T result = fut.get();
-                results.insert({task.first, result});
+
+
+// Submit-to-result latency of every request goes to `latency` (seconds).
+// With `poll` the client checks request_result every 10 ms, as it used to,
+// otherwise it waits on the handle.
+template<typename T, typename Func>
+void run_client(server<T> &s, int N, Func func, std::string file_name, bool poll, std::vector<double> &latency) {
+    std::ofstream file(file_name);
+    latency.resize(N);
+    for (int i = 0; i < N; i++) {
+        Task<T> task(i, i, func);
+        auto start = std::chrono::steady_clock::now();
+        task_options options;
+        options.keep_result = poll;
+        task_handle<T> handle = s.add_task_thread(task, options);
+        T req{};
+        if (poll) {
+            result_status status;
+            while ((status = s.request_result(handle.id, req)) == RESULT_PENDING)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (status != RESULT_READY) {
+                latency[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                file << "ID: " << handle.id << "\nresult lost" << std::endl;
+                continue;
             }
-            lock_res.unlock();
-            // std::this_thread::sleep_for(std::chrono::milliseconds(200));
         }
+        else {
+            req = handle.get();
+        }
+        latency[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        file << "ID: " << handle.id << "\nresult: " << req << std::endl;
     }
+}
+
+
+// Same work submitted in batches of `batch` tasks. The next batch is
+// submitted before waiting for the current one, so the workers always have
+// a batch queued. A request's latency is that of its batch.
+template<typename T, typename Func>
+void run_client_batched(server<T> &s, int N, Func func, std::string file_name, int batch,
+                        std::vector<double> &latency) {
+    std::ofstream file(file_name);
+    latency.resize(N);
+    std::vector<Task<T>> tasks(N);
+    for (int i = 0; i < N; i++)
+        tasks[i] = Task<T>(i, i, func);
+    std::vector<T> results(N);
+    std::vector<result_status> status(N);
+
+    auto submit = [&](int first) {
+        int count = std::min(batch, N - first);
+        return std::make_pair(s.add_tasks(std::span<const Task<T>>(&tasks[first], count)),
+                              std::chrono::steady_clock::now());
+    };
 
-public:
-    void start() {
-        if (!server_is_up) {
-            server_is_up = true;
-            serv_thr = std::thread (&server::server_thread, this);
+    auto current = submit(0);
+    for (int first = 0; first < N; first += batch) {
+        auto next = current;
+        if (first + batch < N)
+            next = submit(first + batch);
+        size_t count = current.first.count;
+        s.wait_all(current.first, std::span<T>(&results[first], count),
+                   std::span<result_status>(&status[first], count));
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - current.second).count();
+        for (size_t i = 0; i < count; i++) {
+            latency[first + i] = elapsed;
+            file << "ID: " << current.first.first + i;
+            if (status[first + i] == RESULT_READY)
+                file << "\nresult: " << results[first + i] << std::endl;
+            else
+                file << "\nresult lost" << std::endl;
         }
+        current = next;
     }
+}
+
 
-    void stop() {
-        server_is_up = false;
-        serv_thr.join();
+void print_latency(const std::string &name, std::vector<double> latency) {
+    if (latency.empty()) {
+        std::cout << name << ": no requests" << std::endl;
+        return;
     }
+    std::sort(latency.begin(), latency.end());
+    auto percentile = [&latency](double p) { return latency[(size_t)(p * (latency.size() - 1))] * 1e6; };
+    std::cout << name << ": p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us" << std::endl;
+}
 
-    size_t add_task_thread(Task<T> t) {
-    std::unique_lock<std::mutex> lock(mut);
 
-    std::function<T()> func = t.get_task_function();
-    std::packaged_task<T()> pt(std::move(func));
-    tasks.push({available_id, std::move(pt)});
-    
-    size_t id = available_id++;
-    
-    return id;
+// A logical client as a coroutine: it submits tasks first..first+count-1
+// one at a time and is suspended while each of them runs.
+client_task coro_client(server<double> &s, executor &exec, double (*func)(double, double), int first, int count,
+                        std::vector<double> &results, std::vector<double> &latency) {
+    for (int i = first; i < first + count; i++) {
+        auto start = std::chrono::steady_clock::now();
+        results[i] = co_await s.submit(Task<double>(i, i, func), {.keep_result = false}, &exec);
+        latency[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
 }
 
 
-    T request_result(size_t id){
-        auto it = results.find(id);
-        if (it != results.end()) {
-            return results[id];
-        }
-        return -1;
+// n requests from `clients` coroutines, all of them driven by the calling
+// thread through one executor.
+void run_coroutines(server<double> &s, int n, int clients) {
+    executor exec(clients);
+    std::vector<double> results(n), latency(n);
+    double (*funcs[3])(double, double) = {fun_pow<double>, fun_sin<double>, fun_sqrt<double>};
+    for (int c = 0; c < clients; c++) {
+        int first = (long)n * c / clients;
+        int last = (long)n * (c + 1) / clients;
+        exec.spawn(coro_client(s, exec, funcs[c % 3], first, last - first, results, latency));
     }
-};
 
-template <typename T>
-T fun_pow(T x, T y) {
-    return std::pow(x, y);
+    auto start = std::chrono::steady_clock::now();
+    exec.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << n << " requests from " << clients << " coroutines on one thread: " << elapsed.count() << " sec. "
+              << n / elapsed.count() << " tasks/s" << std::endl;
+    print_latency("request", latency);
 }
 
-template <typename T>
-T fun_sin(T x, T y) {
-    return std::sin(x);
+
+// Worker throughput on its own: n tasks cycling through pow, sin and sqrt
+// are queued before the workers start, then the time until the last result
+// is in counts. Returns tasks per second.
+double measure_workers(size_t num_workers, size_t n, bool simd) {
+    server<double> s(num_workers, n, n);
+    if (simd) {
+        s.register_batch_kernel(fun_pow<double>, batch_pow);
+        s.register_batch_kernel(fun_sin<double>, select_batch_sin());
+        s.register_batch_kernel(fun_sqrt<double>, select_batch_sqrt());
+    }
+    double (*funcs[3])(double, double) = {fun_pow<double>, fun_sin<double>, fun_sqrt<double>};
+    std::vector<Task<double>> tasks(n);
+    for (size_t i = 0; i < n; i++)
+        tasks[i] = Task<double>(i / 3, i / 3, funcs[i % 3]);
+    std::vector<double> results(n);
+
+    task_range ids = s.add_tasks(tasks);
+    auto start = std::chrono::steady_clock::now();
+    s.start();
+    s.wait_all(ids, results);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    s.stop();
+    return n / elapsed.count();
 }
 
-template <typename T>
-T fun_sqrt(T x, T y) {
-    return std::sqrt(x);
+
+// p50/p99 of the client's submit-to-finish times as the server saw them,
+// without the time the client thread needs to wake up
+void print_server_latency(const std::string &name, server<double> &s, uint32_t client) {
+    std::cout << name << ": p50 " << s.client_latency(client, 0.5).count() / 1e3 << " us, p99 "
+              << s.client_latency(client, 0.99).count() / 1e3 << " us (server side)" << std::endl;
 }
 
 
+// A heavy client keeps bursts of `burst` pow tasks queued while a sin and
+// a sqrt client submit n tasks one at a time and wait for each; workers
+// group same-function tasks. Without `scheduled` all of them share one
+// FIFO. With it every client has its own queue: the heavy client gets 16
+// round robin turns for every turn of sin, and sqrt tasks come with a 1 ms
+// deadline, within DEADLINE_SLACK, which puts them ahead of both at the
+// same priority.
+void run_fairness(size_t num_workers, int n, int burst, bool scheduled) {
+    server<double> s(num_workers);
+    s.register_batch_kernel(fun_pow<double>, batch_pow);
+    s.register_batch_kernel(fun_sin<double>, select_batch_sin());
+    s.register_batch_kernel(fun_sqrt<double>, select_batch_sqrt());
+    task_options heavy, light, urgent;
+    light.keep_result = urgent.keep_result = false;
+    if (scheduled) {
+        heavy.client = s.register_client(16);
+        light.client = s.register_client();
+        urgent.client = s.register_client();
+    }
+    s.start();
+    // a larger burst would be rejected by add_tasks
+    burst = std::min<int>(burst, s.result_capacity());
 
-template<typename T, typename Func>
-void run_client(server<T> &s, int N, Func func, std::string file_name) {
-    std::ofstream file(file_name);
-    for (int i = 0; i < N; i++) {
-        Task<T> task(i, i, func);
-        size_t id = s.add_task_thread(task);
-        T req = s.request_result(id);
-        for (; req == -1; req = s.request_result(id))
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        file << "ID: " << id << "\nresult: " << req << std::endl;
+    std::vector<Task<double>> tasks(burst);
+    for (int i = 0; i < burst; i++)
+        tasks[i] = Task<double>(i, 2, fun_pow<double>);
+    std::vector<double> burst_results(burst);
+    std::vector<double> latency_pow, latency_sin, latency_sqrt;
+    std::atomic<int> running{2};
+
+    std::thread heavy_client([&]() {
+        while (running > 0) {
+            auto start = std::chrono::steady_clock::now();
+            s.wait_all(s.add_tasks(tasks, heavy), burst_results);
+            latency_pow.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+    });
+    auto light_client = [&](double (*func)(double, double), bool deadline, std::vector<double> &latency) {
+        latency.resize(n);
+        for (int i = 0; i < n; i++) {
+            task_options options = deadline ? urgent : light;
+            auto start = std::chrono::steady_clock::now();
+            if (deadline && scheduled)
+                options.deadline = start + std::chrono::milliseconds(1);
+            s.add_task_thread(Task<double>(i, i, func), options).get();
+            latency[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        running--;
+    };
+    std::thread sin_client(light_client, fun_sin<double>, false, std::ref(latency_sin));
+    std::thread sqrt_client(light_client, fun_sqrt<double>, true, std::ref(latency_sqrt));
+
+    sin_client.join();
+    sqrt_client.join();
+    heavy_client.join();
+    s.stop();
+
+    size_t over = std::count_if(latency_sqrt.begin(), latency_sqrt.end(), [](double t) { return t > 1e-3; });
+    std::cout << (scheduled ? "scheduled" : "one FIFO") << ":" << std::endl;
+    print_latency("  pow bursts", latency_pow);
+    print_latency("  sin", latency_sin);
+    print_latency("  sqrt", latency_sqrt);
+    if (scheduled) {
+        print_server_latency("  pow", s, heavy.client);
+        print_server_latency("  sin", s, light.client);
+        print_server_latency("  sqrt", s, urgent.client);
+        std::cout << "  sqrt deadlines missed: " << s.missed_deadlines(urgent.client) << " of " << n
+                  << " (server side), " << over << " over 1 ms at the client" << std::endl;
+    }
+    else {
+        print_server_latency("  all clients", s, 0);
+        std::cout << "  sqrt over 1 ms at the client: " << over << " of " << n << std::endl;
     }
 }
 
 
-int main() {
-    server<double> s;
+// usage: server [workers] [N] [wait|poll|batch|group|fair|coro] [batch size|clients] [simd]
+// with simd the workers evaluate same-function tasks through the kernels of
+// batch_kernels.hpp; group compares worker throughput with and without;
+// fair runs N light requests next to bursts of batch size heavy ones, in
+// one FIFO and with per-client scheduling; coro sends the 3N requests
+// from `clients` coroutines (1000 by default) on one thread
+int main(int argc, char **argv) {
+    size_t num_workers = std::thread::hardware_concurrency();
+    if (argc > 1)
+        num_workers = std::stoul(argv[1]);
+    if (argc > 2)
+        N = std::stoul(argv[2]);
+
+    if (argc > 3 && std::string(argv[3]) == "group") {
+        double single = measure_workers(num_workers, 3 * N, false);
+        double grouped = measure_workers(num_workers, 3 * N, true);
+        std::cout << "one by one: " << single << " tasks/s, grouped: " << grouped << " tasks/s, speedup "
+                  << grouped / single << std::endl;
+        return 0;
+    }
+    if (argc > 3 && std::string(argv[3]) == "fair") {
+        int burst = argc > 4 ? std::stoi(argv[4]) : 10000;
+        run_fairness(num_workers, N, burst, false);
+        run_fairness(num_workers, N, burst, true);
+        return 0;
+    }
+    if (argc > 3 && std::string(argv[3]) == "coro") {
+        int clients = argc > 4 ? std::stoi(argv[4]) : 1000;
+        server<double> s(num_workers);
+        s.start();
+        run_coroutines(s, 3 * N, clients);
+        s.stop();
+        return 0;
+    }
+    bool poll = argc > 3 && std::string(argv[3]) == "poll";
+    bool batched = argc > 3 && std::string(argv[3]) == "batch";
+    int batch = 1000;
+    if (argc > 4)
+        batch = std::stoi(argv[4]);
+
+    bool simd = argc > 5 && std::string(argv[5]) == "simd";
+
+    server<double> s(num_workers);
+    if (simd) {
+        s.register_batch_kernel(fun_pow<double>, batch_pow);
+        s.register_batch_kernel(fun_sin<double>, select_batch_sin());
+        s.register_batch_kernel(fun_sqrt<double>, select_batch_sqrt());
+    }
+    // three clients with two batches each in flight have to fit into the
+    // result store, or their early results are overwritten
+    if (batched && (size_t)batch * 6 > s.result_capacity()) {
+        batch = s.result_capacity() / 6;
+        std::cout << "Batch size limited to " << batch << " by the result store" << std::endl;
+    }
     s.start();
-    std::cout << "Server started..." << std::endl;
+    std::cout << "Server started with " << num_workers << " workers..." << std::endl;
 
+    auto start = std::chrono::steady_clock::now();
 
-    std::thread client1([&s]() { run_client<double>(s, N, fun_pow<double>, "pow.txt");});
-    std::thread client2([&s]() { run_client<double>(s, N, fun_sin<double>, "sin.txt");});
-    std::thread client3([&s]() { run_client<double>(s, N, fun_sqrt<double>, "sqrt.txt");});
+    std::vector<double> latency1, latency2, latency3;
+    auto client = [&](double (*func)(double, double), std::string file_name, std::vector<double> &latency) {
+        if (batched)
+            run_client_batched<double>(s, N, func, file_name, batch, latency);
+        else
+            run_client<double>(s, N, func, file_name, poll, latency);
+    };
+    std::thread client1([&]() { client(fun_pow<double>, "pow.txt", latency1);});
+    std::thread client2([&]() { client(fun_sin<double>, "sin.txt", latency2);});
+    std::thread client3([&]() { client(fun_sqrt<double>, "sqrt.txt", latency3);});
 
     client1.join();
     client2.join();
     client3.join();
 
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Elapsed time: " << elapsed.count() << " sec. " << 3 * N / elapsed.count() << " tasks/s" << std::endl;
+    print_latency("pow", latency1);
+    print_latency("sin", latency2);
+    print_latency("sqrt", latency3);
+    std::cout << "Results held by the server: " << s.stored_results() << std::endl;
+
     s.stop();
     std::cout << "Server closed..." << std::endl;
 
@@ -0,0 +1,806 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <span>
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "executor.hpp"
+#include "latency_histogram.hpp"
+#include "mpmc_queue.hpp"
+#include "result_store.hpp"
+#include "small_function.hpp"
+
+
+template<typename T>
+class Task {
+private:
+    small_function<T(T, T)> _function;
+
+public:
+    size_t x = 0, y = 0;
+
+    Task() = default;
+
+    // the callable is kept inline, it has to fit into small_function
+    template<typename F>
+    Task(size_t _x, size_t _y, F function) : _function(std::move(function)), x(_x), y(_y) {}
+
+    T execute_function() {
+        return _function(x, y);
+    }
+
+    // the plain function behind the task, if it is one; tasks with the
+    // same function can be evaluated together
+    T (*function_pointer() const)(T, T) {
+        auto f = _function.template target<T (*)(T, T)>();
+        return f ? *f : nullptr;
+    }
+};
+
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_QUEUED,
+    SLOT_DONE,
+    SLOT_ABANDONED,  // the handle is gone before the task finished
+    SLOT_DETACHED,   // batch task, the result is only kept in the store
+    SLOT_AWAITED     // a suspended coroutine waits for the result
+};
+
+// A task with room for its result. Slots are allocated once with the server
+// and go back to the free ring when the result has been collected.
+template<typename T>
+struct alignas(64) task_slot {
+    Task<T> task;
+    size_t id = 0;
+    T result{};
+    uint32_t client = 0;
+    bool keep_result = false;
+    std::chrono::steady_clock::time_point submitted;
+    std::chrono::steady_clock::time_point deadline;
+    std::coroutine_handle<> waiter;
+    executor *waiter_executor = nullptr;
+    std::atomic<int> state{SLOT_FREE};
+};
+
+// Someone who waits for a slot without holding on to a thread. The waiter
+// stays where it is (a coroutine frame) and start() is called with the slot
+// once there is one.
+struct slot_waiter {
+    slot_waiter *next = nullptr;
+    void (*start)(slot_waiter *self, uint32_t index) = nullptr;
+};
+
+template<typename T>
+class slot_pool {
+private:
+    std::unique_ptr<task_slot<T>[]> slots;
+    size_t num_slots;
+    mpmc_queue<uint32_t> free_slots;
+
+    // parked waiters in arrival order; num_waiters lets release() skip the
+    // mutex while nobody is parked
+    std::mutex waiters_mut;
+    slot_waiter *waiters_head = nullptr;
+    slot_waiter *waiters_tail = nullptr;
+    std::atomic<size_t> num_waiters{0};
+
+    // hands free slots to parked waiters, start() runs outside the lock
+    void wake_waiters() {
+        while (true) {
+            slot_waiter *w;
+            std::optional<uint32_t> index;
+            {
+                std::lock_guard<std::mutex> lock(waiters_mut);
+                if (!waiters_head || !(index = free_slots.try_pop()))
+                    return;
+                w = waiters_head;
+                waiters_head = w->next;
+                if (!waiters_head)
+                    waiters_tail = nullptr;
+                num_waiters.fetch_sub(1, std::memory_order_relaxed);
+            }
+            w->start(w, *index);
+        }
+    }
+
+public:
+    explicit slot_pool(size_t size) : slots(new task_slot<T>[size]), num_slots(size), free_slots(size) {
+        for (uint32_t i = 0; i < size; i++)
+            free_slots.try_push(i);
+    }
+
+    task_slot<T> &operator[](uint32_t index) {
+        return slots[index];
+    }
+
+    // yields while every slot is in use, which pushes back on the clients
+    uint32_t acquire() {
+        std::optional<uint32_t> index;
+        while (!(index = free_slots.try_pop()))
+            std::this_thread::yield();
+        return *index;
+    }
+
+    // n slots with one reservation on the free ring
+    void acquire_n(uint32_t *indices, size_t n) {
+        while (!free_slots.try_pop_n(indices, n))
+            std::this_thread::yield();
+    }
+
+    std::optional<uint32_t> try_acquire() {
+        return free_slots.try_pop();
+    }
+
+    // Starts w with a slot right away if one is free, otherwise parks it
+    // until release() frees one. start() may run on this thread before
+    // park() returns or later on the releasing thread.
+    void park(slot_waiter *w) {
+        std::optional<uint32_t> index;
+        {
+            std::lock_guard<std::mutex> lock(waiters_mut);
+            num_waiters.fetch_add(1);
+            // pairs with the fence in release(): either the release sees
+            // the waiter or this pop sees the released slot
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            index = free_slots.try_pop();
+            if (index) {
+                num_waiters.fetch_sub(1, std::memory_order_relaxed);
+            } else {
+                w->next = nullptr;
+                if (waiters_tail)
+                    waiters_tail->next = w;
+                else
+                    waiters_head = w;
+                waiters_tail = w;
+            }
+        }
+        if (index)
+            w->start(w, *index);
+    }
+
+    void release(uint32_t index) {
+        slots[index].state.store(SLOT_FREE, std::memory_order_relaxed);
+        free_slots.try_push(index);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (num_waiters.load(std::memory_order_relaxed) > 0)
+            wake_waiters();
+    }
+
+    size_t size() const {
+        return num_slots;
+    }
+};
+
+
+// ids of a batch, they are consecutive
+struct task_range {
+    size_t first = 0;
+    size_t count = 0;
+};
+
+
+enum task_priority {
+    PRIORITY_HIGH,
+    PRIORITY_NORMAL,
+    PRIORITY_LOW,
+    NUM_PRIORITIES
+};
+
+#define NO_DEADLINE std::chrono::steady_clock::time_point::max()
+
+// How a task is scheduled. The priority level comes first. Within a level
+// a task whose deadline is less than DEADLINE_SLACK away runs before the
+// round robin, earliest deadline first whichever client it comes from.
+// Further deadlines wait until they get that close or the level has
+// nothing else. A deadline never lifts a task above a higher level.
+struct task_options {
+    int priority = PRIORITY_NORMAL;
+    std::chrono::steady_clock::time_point deadline = NO_DEADLINE;
+    uint32_t client = 0;   // from register_client, 0 is the default client
+    // keep the result in the store for request_result; a caller that only
+    // reads it from the handle or co_await can leave the store alone.
+    // Batch results are always kept
+    bool keep_result = true;
+};
+
+
+// Waitable handle to a submitted task. get() blocks until the worker has
+// stored the result in the slot and then gives the slot back; dropping the
+// handle early leaves that to the worker.
+template<typename T>
+class task_handle {
+private:
+    slot_pool<T> *pool = nullptr;
+    uint32_t index = 0;
+
+    void release() {
+        if (!pool)
+            return;
+        int expected = SLOT_QUEUED;
+        if (!(*pool)[index].state.compare_exchange_strong(expected, SLOT_ABANDONED))
+            pool->release(index);
+        pool = nullptr;
+    }
+
+public:
+    size_t id = 0;
+
+    task_handle() = default;
+    task_handle(slot_pool<T> *p, uint32_t i, size_t task_id) : pool(p), index(i), id(task_id) {}
+
+    task_handle(task_handle &&other) noexcept : pool(other.pool), index(other.index), id(other.id) {
+        other.pool = nullptr;
+    }
+
+    task_handle &operator=(task_handle &&other) noexcept {
+        if (this != &other) {
+            release();
+            pool = std::exchange(other.pool, nullptr);
+            index = other.index;
+            id = other.id;
+        }
+        return *this;
+    }
+
+    ~task_handle() {
+        release();
+    }
+
+    bool ready() const {
+        return (*pool)[index].state.load(std::memory_order_acquire) == SLOT_DONE;
+    }
+
+    T get() {
+        std::atomic<int> &state = (*pool)[index].state;
+        while (state.load(std::memory_order_acquire) == SLOT_QUEUED)
+            state.wait(SLOT_QUEUED, std::memory_order_acquire);
+        T result = (*pool)[index].result;
+        release();
+        return result;
+    }
+};
+
+
+// tasks a worker takes at once when it can group them
+#define TASK_GROUP 64
+#define MAX_BATCH_KERNELS 8
+#define MAX_CLIENTS 16
+#define MAX_CLIENT_WEIGHT 16
+// how close a deadline has to be before its task goes ahead of the turns
+#define DEADLINE_SLACK std::chrono::milliseconds(5)
+
+// Tasks are executed by a pool of workers. Clients and workers meet in
+// lock-free rings of slot indices and results go to a sharded store, so
+// clients keep submitting while tasks run and workers publish in parallel.
+// Idle workers sleep on `wake_epoch`, which every push advances. Slots,
+// rings and the store are all allocated by the constructor (and
+// register_client): submitting and collecting a task does not touch the heap.
+//
+// A worker takes the priority levels from high to low. Within a level it
+// takes the tasks whose deadline is near first, in deadline order across
+// all clients, then the clients get turns in weighted round robin, so a
+// client with a long backlog delays the others by at most one turn. A far
+// deadline does not jump the turns, otherwise a client could put one on
+// every task and starve the rest. Submit-to-finish times are recorded per
+// client.
+template<typename T>
+class server {
+private:
+    // Queued slot indices of one client without a deadline, a ring per
+    // priority level. Every ring has a place for every slot, so queueing
+    // never fails.
+    struct client_queue {
+        unsigned weight;
+        mpmc_queue<uint32_t> levels[NUM_PRIORITIES];
+        std::atomic<size_t> missed{0};
+        latency_histogram latency;
+
+        static_assert(NUM_PRIORITIES == 3, "one ring per level below");
+        client_queue(unsigned w, size_t capacity)
+            : weight(w),
+              levels{mpmc_queue<uint32_t>(capacity), mpmc_queue<uint32_t>(capacity), mpmc_queue<uint32_t>(capacity)} {}
+    };
+
+    // Deadline tasks of one priority level from all clients, earliest
+    // first. The heap has room reserved for every slot, so pushing does not
+    // allocate.
+    struct deadline_queue {
+        using entry = std::pair<std::chrono::steady_clock::time_point, uint32_t>;
+        using heap = std::priority_queue<entry, std::vector<entry>, std::greater<entry>>;
+
+        std::mutex mut;
+        heap tasks;
+        std::atomic<size_t> size{0};
+
+        void reserve(size_t capacity) {
+            std::vector<entry> storage;
+            storage.reserve(capacity);
+            tasks = heap(std::greater<entry>(), std::move(storage));
+        }
+    };
+
+    slot_pool<T> slots;
+    deadline_queue deadlines[NUM_PRIORITIES];
+    std::unique_ptr<client_queue> clients[MAX_CLIENTS];
+    size_t num_clients = 1;
+    // the turns of one round, client c is in it weight(c) times
+    uint8_t schedule[MAX_CLIENTS * MAX_CLIENT_WEIGHT] = {};
+    size_t schedule_len = 1;
+    std::atomic<size_t> turn{0};
+    result_store<T> results;
+    std::mutex mut; // start/stop
+    std::atomic<size_t> wake_epoch{0};
+    std::vector<std::thread> workers;
+    size_t num_workers;
+    std::atomic<bool> server_is_up{false};
+    std::atomic<size_t> available_id{0};
+    // clients in wait_all sleep on done_epoch, workers only bump it while
+    // there are any
+    std::atomic<size_t> done_epoch{0};
+    std::atomic<int> batch_waiters{0};
+
+    // out[k] = f(x[k], y[k]) for every task of a group with function f
+    using batch_kernel_func = void (*)(const T *x, const T *y, T *out, size_t n);
+    struct batch_kernel_entry {
+        T (*function)(T, T);
+        batch_kernel_func kernel;
+    };
+    batch_kernel_entry kernels[MAX_BATCH_KERNELS];
+    size_t num_kernels = 0;
+
+    // Smooth weighted round robin: every step each client gains its weight
+    // and the one with the most takes the turn and pays the total. Turns of
+    // a heavy client are spread over the round instead of coming in a row.
+    void build_schedule() {
+        int credit[MAX_CLIENTS] = {};
+        int total = 0;
+        for (size_t c = 0; c < num_clients; c++)
+            total += clients[c]->weight;
+        for (int i = 0; i < total; i++) {
+            size_t best = 0;
+            for (size_t c = 0; c < num_clients; c++) {
+                credit[c] += clients[c]->weight;
+                if (credit[c] > credit[best])
+                    best = c;
+            }
+            credit[best] -= total;
+            schedule[i] = best;
+        }
+        schedule_len = total;
+    }
+
+    // the slots are filled in, make them visible to the workers
+    void enqueue(const uint32_t *indices, size_t n, const task_options &options) {
+        if (options.deadline == NO_DEADLINE) {
+            clients[options.client]->levels[options.priority].try_push_n(indices, n);
+        }
+        else {
+            deadline_queue &q = deadlines[options.priority];
+            std::lock_guard<std::mutex> lock(q.mut);
+            for (size_t i = 0; i < n; i++)
+                q.tasks.push({options.deadline, indices[i]});
+            q.size.fetch_add(n);
+        }
+        wake_epoch.fetch_add(1);
+        if (n == 1)
+            wake_epoch.notify_one();
+        else
+            wake_epoch.notify_all();
+    }
+
+    // unknown clients and priorities fall back to the defaults
+    task_options checked(task_options options) const {
+        if (options.client >= num_clients)
+            options.client = 0;
+        if (options.priority < 0 || options.priority >= NUM_PRIORITIES)
+            options.priority = PRIORITY_NORMAL;
+        return options;
+    }
+
+    // up to max deadline tasks of a level, earliest deadline first; with
+    // near_only only those due within DEADLINE_SLACK
+    size_t take_deadlines(int level, uint32_t *out, size_t max, bool near_only) {
+        deadline_queue &q = deadlines[level];
+        if (q.size.load() == 0)
+            return 0;
+        std::chrono::steady_clock::time_point limit =
+            near_only ? std::chrono::steady_clock::now() + DEADLINE_SLACK : NO_DEADLINE;
+        size_t n = 0;
+        std::lock_guard<std::mutex> lock(q.mut);
+        for (; n < max && !q.tasks.empty() && q.tasks.top().first <= limit; n++) {
+            out[n] = q.tasks.top().second;
+            q.tasks.pop();
+        }
+        q.size.fetch_sub(n);
+        return n;
+    }
+
+    // up to max tasks of a client at one level
+    size_t take(client_queue &q, int level, uint32_t *out, size_t max) {
+        size_t n = 0;
+        for (std::optional<uint32_t> next; n < max && (next = q.levels[level].try_pop());)
+            out[n++] = *next;
+        return n;
+    }
+
+    // The tasks of the next turn, from the most urgent level that has any:
+    // its near deadline tasks, otherwise the first client after the turn
+    // counter that has some, otherwise the far deadline tasks.
+    size_t pick(uint32_t *out, size_t max) {
+        size_t start = schedule_len > 1 ? turn.fetch_add(1, std::memory_order_relaxed) : 0;
+        for (int level = 0; level < NUM_PRIORITIES; level++) {
+            size_t n = take_deadlines(level, out, max, true);
+            if (n > 0)
+                return n;
+            for (size_t i = 0; i < schedule_len; i++) {
+                n = take(*clients[schedule[(start + i) % schedule_len]], level, out, max);
+                if (n > 0)
+                    return n;
+            }
+            n = take_deadlines(level, out, max, false);
+            if (n > 0)
+                return n;
+        }
+        return 0;
+    }
+
+    // slot.result is set, hand it to whoever waits
+    void finish(uint32_t index) {
+        task_slot<T> &slot = slots[index];
+        client_queue &client = *clients[slot.client];
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        client.latency.record(now - slot.submitted);
+        if (now > slot.deadline)
+            client.missed.fetch_add(1, std::memory_order_relaxed);
+        // handle and coroutine results are read from the slot
+        if (slot.keep_result)
+            results.put(slot.id, slot.result);
+        int expected = SLOT_QUEUED;
+        if (slot.state.compare_exchange_strong(expected, SLOT_DONE, std::memory_order_acq_rel)) {
+            slot.state.notify_all();
+        }
+        else if (expected == SLOT_AWAITED) {
+            // the coroutine takes the result and frees the slot
+            if (slot.waiter_executor)
+                slot.waiter_executor->post(slot.waiter);
+            else
+                slot.waiter.resume();
+        }
+        else {
+            slots.release(index);
+        }
+    }
+
+    int find_kernel(T (*function)(T, T)) const {
+        for (size_t k = 0; function && k < num_kernels; k++) {
+            if (kernels[k].function == function)
+                return k;
+        }
+        return -1;
+    }
+
+    // Runs the picked tasks: those with a registered kernel are gathered
+    // per kernel and evaluated in one call, the rest one by one.
+    void run_grouped(const uint32_t *picked, size_t n) {
+        uint32_t groups[MAX_BATCH_KERNELS][TASK_GROUP];
+        size_t group_size[MAX_BATCH_KERNELS] = {};
+        for (size_t i = 0; i < n; i++) {
+            task_slot<T> &slot = slots[picked[i]];
+            int k = find_kernel(slot.task.function_pointer());
+            if (k < 0) {
+                slot.result = slot.task.execute_function();
+                finish(picked[i]);
+            }
+            else {
+                groups[k][group_size[k]++] = picked[i];
+            }
+        }
+
+        T x[TASK_GROUP], y[TASK_GROUP], out[TASK_GROUP];
+        for (size_t k = 0; k < num_kernels; k++) {
+            if (group_size[k] == 0)
+                continue;
+            for (size_t i = 0; i < group_size[k]; i++) {
+                x[i] = slots[groups[k][i]].task.x;
+                y[i] = slots[groups[k][i]].task.y;
+            }
+            kernels[k].kernel(x, y, out, group_size[k]);
+            for (size_t i = 0; i < group_size[k]; i++) {
+                slots[groups[k][i]].result = out[i];
+                finish(groups[k][i]);
+            }
+        }
+    }
+
+    void server_thread() {
+        // without kernels there is nothing to group, take one task at a time
+        size_t group = num_kernels > 0 ? TASK_GROUP : 1;
+        uint32_t picked[TASK_GROUP];
+        while (true) {
+            // read the epoch first: a push after the failed pop changes it,
+            // so the wait below can not miss that task
+            size_t epoch = wake_epoch.load();
+            size_t n = pick(picked, group);
+            if (n == 0) {
+                if (!server_is_up) {
+                    return;
+                }
+                wake_epoch.wait(epoch);
+                continue;
+            }
+
+            if (group == 1) {
+                slots[picked[0]].result = slots[picked[0]].task.execute_function();
+                finish(picked[0]);
+            }
+            else {
+                run_grouped(picked, n);
+            }
+
+            // once per pick, not per task
+            if (batch_waiters.load() > 0) {
+                done_epoch.fetch_add(1);
+                done_epoch.notify_all();
+            }
+        }
+    }
+
+public:
+    // queue_capacity is the number of task slots; results nobody asks for
+    // are dropped after result_ttl or once result_capacity newer ones are stored
+    explicit server(size_t workers_count = std::thread::hardware_concurrency(), size_t queue_capacity = 1 << 16,
+                    size_t result_capacity = 1 << 16,
+                    std::chrono::steady_clock::duration result_ttl = std::chrono::seconds(60))
+        : slots(queue_capacity), results(result_capacity, result_ttl),
+          num_workers(workers_count == 0 ? 1 : workers_count) {
+        clients[0] = std::make_unique<client_queue>(1, queue_capacity);
+        for (auto &q : deadlines)
+            q.reserve(queue_capacity);
+    }
+
+    // A client with weight w gets w turns per round while several clients
+    // have tasks at the same level. Register before start(); returns the id
+    // for task_options::client, or -1.
+    int register_client(unsigned weight = 1) {
+        if (server_is_up || num_clients == MAX_CLIENTS)
+            return -1;
+        weight = std::clamp(weight, 1u, (unsigned)MAX_CLIENT_WEIGHT);
+        clients[num_clients++] = std::make_unique<client_queue>(weight, slots.size());
+        build_schedule();
+        return num_clients - 1;
+    }
+
+    void set_client_weight(uint32_t client, unsigned weight) {
+        if (server_is_up || client >= num_clients)
+            return;
+        clients[client]->weight = std::clamp(weight, 1u, (unsigned)MAX_CLIENT_WEIGHT);
+        build_schedule();
+    }
+
+    // tasks of the client that finished after their deadline
+    size_t missed_deadlines(uint32_t client) {
+        return client < num_clients ? clients[client]->missed.load() : 0;
+    }
+
+    // Submit-to-finish time that a fraction p of the client's tasks did not
+    // exceed, from a histogram (at most 12.5% high).
+    std::chrono::nanoseconds client_latency(uint32_t client, double p) {
+        return client < num_clients ? clients[client]->latency.percentile(p) : std::chrono::nanoseconds(0);
+    }
+
+    // Tasks whose function is `function` are then evaluated in groups of up
+    // to TASK_GROUP through `kernel`. Register before start().
+    bool register_batch_kernel(T (*function)(T, T), batch_kernel_func kernel) {
+        if (server_is_up || num_kernels == MAX_BATCH_KERNELS)
+            return false;
+        kernels[num_kernels++] = {function, kernel};
+        return true;
+    }
+
+    void start() {
+        std::lock_guard<std::mutex> lock(mut);
+        if (!server_is_up) {
+            server_is_up = true;
+            for (size_t i = 0; i < num_workers; i++)
+                workers.emplace_back(&server::server_thread, this);
+        }
+    }
+
+    // workers drain the queue before they exit
+    void stop() {
+        server_is_up = false;
+        wake_epoch.fetch_add(1);
+        wake_epoch.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    // Awaitable of submit(). The task is queued only in await_suspend, with
+    // the coroutine stored in its slot, so there is nothing to miss.
+    class submit_awaiter : private slot_waiter {
+    private:
+        server *owner;
+        Task<T> task;
+        task_options options;
+        executor *exec;
+        std::coroutine_handle<> coroutine;
+        uint32_t index = 0;
+
+        static void start_with(slot_waiter *self, uint32_t slot_index) {
+            static_cast<submit_awaiter *>(self)->launch(slot_index);
+        }
+
+        void launch(uint32_t slot_index) {
+            server &s = *owner;
+            task_options queued = s.checked(options);
+            index = slot_index;
+            task_slot<T> &slot = s.slots[index];
+            slot.task = std::move(task);
+            slot.id = s.available_id.fetch_add(1);
+            slot.client = queued.client;
+            slot.deadline = queued.deadline;
+            slot.submitted = std::chrono::steady_clock::now();
+            slot.keep_result = queued.keep_result;
+            slot.waiter = coroutine;
+            slot.waiter_executor = exec;
+            slot.state.store(SLOT_AWAITED, std::memory_order_relaxed);
+            // the coroutine may be resumed before enqueue returns, after
+            // this point the awaiter is not touched
+            uint32_t queued_index = slot_index;
+            s.enqueue(&queued_index, 1, queued);
+        }
+
+    public:
+        submit_awaiter(server *s, Task<T> t, task_options o, executor *e)
+            : owner(s), task(std::move(t)), options(o), exec(e) {
+            start = start_with;
+        }
+
+        bool await_ready() const {
+            return false;
+        }
+
+        // With every slot taken the coroutine is parked on the pool instead
+        // of spinning: the slots are freed by coroutines that the same
+        // executor thread still has to resume. Whoever releases a slot then
+        // submits the task.
+        void await_suspend(std::coroutine_handle<> c) {
+            coroutine = c;
+            if (std::optional<uint32_t> free = owner->slots.try_acquire())
+                launch(*free);
+            else
+                owner->slots.park(this);
+        }
+
+        T await_resume() {
+            T result = owner->slots[index].result;
+            owner->slots.release(index);
+            return result;
+        }
+    };
+
+    // co_await submit(task) suspends the calling coroutine without blocking
+    // a thread. The worker that finishes the task resumes it, or posts it to
+    // `exec` so it continues on the executor's thread.
+    submit_awaiter submit(Task<T> t, task_options options = {}, executor *exec = nullptr) {
+        return submit_awaiter(this, std::move(t), options, exec);
+    }
+
+    // The handle completes as soon as a worker has the result. Unless
+    // options.keep_result is cleared the id can also be used with
+    // request_result.
+    task_handle<T> add_task_thread(Task<T> t, task_options options = {}) {
+        options = checked(options);
+        uint32_t index = slots.acquire();
+        task_slot<T> &slot = slots[index];
+        slot.task = std::move(t);
+        slot.id = available_id.fetch_add(1);
+        slot.client = options.client;
+        slot.deadline = options.deadline;
+        slot.submitted = std::chrono::steady_clock::now();
+        slot.keep_result = options.keep_result;
+        slot.state.store(SLOT_QUEUED, std::memory_order_relaxed);
+        enqueue(&index, 1, options);
+        return task_handle<T>(&slots, index, slot.id);
+    }
+
+
+    // Submits a whole batch under consecutive ids. Slots and ring places
+    // are reserved for up to half of the slots at a time, so a batch larger
+    // than the pool still goes through while workers drain it. Results go
+    // to the store only: a client must collect them before
+    // result_capacity() newer tasks overwrite them. A batch larger than
+    // that could never be collected whole and is rejected with an empty
+    // range.
+    task_range add_tasks(std::span<const Task<T>> batch, task_options options = {}) {
+        if (batch.size() > results.capacity())
+            return task_range{};
+        options = checked(options);
+        task_range ids{available_id.fetch_add(batch.size()), batch.size()};
+        size_t chunk = std::max<size_t>(1, slots.size() / 2);
+        uint32_t indices[256];
+        chunk = std::min<size_t>(chunk, 256);
+        for (size_t done = 0; done < batch.size(); done += chunk) {
+            size_t n = std::min(chunk, batch.size() - done);
+            slots.acquire_n(indices, n);
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < n; i++) {
+                task_slot<T> &slot = slots[indices[i]];
+                slot.task = batch[done + i];
+                slot.id = ids.first + done + i;
+                slot.client = options.client;
+                slot.deadline = options.deadline;
+                slot.submitted = now;
+                slot.keep_result = true;
+                slot.state.store(SLOT_DETACHED, std::memory_order_relaxed);
+            }
+            enqueue(indices, n, options);
+        }
+        return ids;
+    }
+
+
+    // RESULT_READY puts the result in out; a result can be taken only once
+    result_status request_result(size_t id, T &out) {
+        if (id >= available_id.load())
+            return RESULT_UNKNOWN;
+        return results.take(id, out);
+    }
+
+    // Asks again for every result of the range whose status is still
+    // RESULT_PENDING (start with all of them pending) and returns how many
+    // are settled, ready or lost.
+    size_t request_results(task_range ids, std::span<T> out, std::span<result_status> status) {
+        size_t settled = 0;
+        for (size_t i = 0; i < ids.count; i++) {
+            if (status[i] == RESULT_PENDING)
+                status[i] = request_result(ids.first + i, out[i]);
+            settled += status[i] != RESULT_PENDING;
+        }
+        return settled;
+    }
+
+    // Blocks until every result of the range is settled and returns true if
+    // all of them are in out. Results evicted before they were collected
+    // (too many newer results, or older than result_ttl) make it return
+    // false; status, if given, tells which ones.
+    bool wait_all(task_range ids, std::span<T> out, std::span<result_status> status = {}) {
+        bool complete = true;
+        batch_waiters.fetch_add(1);
+        for (size_t i = 0; i < ids.count; i++) {
+            result_status settled;
+            while (true) {
+                size_t epoch = done_epoch.load();
+                settled = results.take(ids.first + i, out[i]);
+                if (settled != RESULT_PENDING)
+                    break;
+                done_epoch.wait(epoch);
+            }
+            if (!status.empty())
+                status[i] = settled;
+            complete = complete && settled == RESULT_READY;
+        }
+        batch_waiters.fetch_sub(1);
+        return complete;
+    }
+
+    size_t result_capacity() const {
+        return results.capacity();
+    }
+
+    size_t stored_results() {
+        return results.size();
+    }
+};
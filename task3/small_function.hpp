@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// std::function without the heap: the callable is stored inside the object
+// and a callable that does not fit is a compile error rather than an
+// allocation.
+template <typename Sig, size_t Size = 32>
+class small_function;
+
+template <typename R, typename... Args, size_t Size>
+class small_function<R(Args...), Size>
+{
+private:
+    struct ops
+    {
+        R (*invoke)(void *, Args...);
+        void (*copy)(void *dst, const void *src);
+        void (*destroy)(void *);
+    };
+
+    template <typename F>
+    static constexpr ops ops_for = {
+        [](void *f, Args... args) -> R { return (*static_cast<F *>(f))(std::forward<Args>(args)...); },
+        [](void *dst, const void *src) { new (dst) F(*static_cast<const F *>(src)); },
+        [](void *f) { static_cast<F *>(f)->~F(); },
+    };
+
+    alignas(std::max_align_t) mutable unsigned char storage[Size];
+    const ops *vtable = nullptr;
+
+public:
+    small_function() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, small_function>>>
+    small_function(F &&f)
+    {
+        using Fn = std::decay_t<F>;
+        static_assert(sizeof(Fn) <= Size && alignof(Fn) <= alignof(std::max_align_t),
+                      "callable does not fit into small_function");
+        new (storage) Fn(std::forward<F>(f));
+        vtable = &ops_for<Fn>;
+    }
+
+    small_function(const small_function &other) : vtable(other.vtable)
+    {
+        if (vtable)
+            vtable->copy(storage, other.storage);
+    }
+
+    small_function &operator=(const small_function &other)
+    {
+        if (this != &other)
+        {
+            reset();
+            vtable = other.vtable;
+            if (vtable)
+                vtable->copy(storage, other.storage);
+        }
+        return *this;
+    }
+
+    ~small_function() { reset(); }
+
+    void reset()
+    {
+        if (vtable)
+            vtable->destroy(storage);
+        vtable = nullptr;
+    }
+
+    explicit operator bool() const { return vtable != nullptr; }
+
+    // the stored callable if it is an F, like std::function::target
+    template <typename F>
+    const F *target() const
+    {
+        return vtable == &ops_for<F> ? std::launder(reinterpret_cast<const F *>(storage)) : nullptr;
+    }
+
+    R operator()(Args... args) const { return vtable->invoke(storage, std::forward<Args>(args)...); }
+};
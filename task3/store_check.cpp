@@ -0,0 +1,64 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include "result_store.hpp"
+#include "server.hpp"
+
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+    if (!ok) {
+        std::cout << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+
+// Checks that result_store tells a pending result from one that is gone:
+// taken, overwritten by a newer id, or expired, and that the server keeps
+// the results of tasks submitted with default options.
+int main() {
+    double out = 0.0;
+
+    // 4 shards with 2 places each
+    result_store<double> store(8, std::chrono::seconds(60), 4);
+    expect(store.take(0, out) == RESULT_PENDING, "nothing stored yet is pending");
+    store.put(0, 1.5);
+    expect(store.take(0, out) == RESULT_READY && out == 1.5, "stored result is ready");
+    expect(store.take(0, out) == RESULT_EVICTED, "a result can be taken once");
+
+    // ids 1 and 9 share a place, 9 overwrites 1
+    store.put(1, 2.0);
+    store.put(9, 3.0);
+    expect(store.take(1, out) == RESULT_EVICTED, "overwritten result is evicted");
+    expect(store.take(17, out) == RESULT_PENDING, "next id in the same place is pending");
+    expect(store.take(9, out) == RESULT_READY && out == 3.0, "newer result survives");
+
+    // an older id finishing late does not replace a newer one
+    store.put(10, 4.0);
+    store.put(2, 5.0);
+    expect(store.take(10, out) == RESULT_READY && out == 4.0, "late older put is dropped");
+    expect(store.take(2, out) == RESULT_EVICTED, "late older result is evicted");
+
+    result_store<double> short_lived(8, std::chrono::milliseconds(20), 4);
+    short_lived.put(3, 6.0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    expect(short_lived.take(3, out) == RESULT_EVICTED, "expired result is evicted");
+    expect(short_lived.size() == 1, "expired result still counts until overwritten");
+
+    server<double> s(1, 16);
+    s.start();
+    task_handle<double> handle = s.add_task_thread(Task<double>(1, 2, [](double x, double y) { return x + y; }));
+    size_t id = handle.id;
+    expect(handle.get() == 3.0, "handle gets the result");
+    expect(s.request_result(id, out) == RESULT_READY && out == 3.0, "default task result can be polled");
+    task_options handle_only;
+    handle_only.keep_result = false;
+    handle = s.add_task_thread(Task<double>(1, 2, [](double x, double y) { return x * y; }), handle_only);
+    expect(handle.get() == 2.0, "handle-only task still completes");
+    s.stop();
+
+    std::cout << (failures == 0 ? "result store checks passed" : "result store checks failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
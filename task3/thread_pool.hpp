@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Persistent pool with one deque per thread. A thread takes chunks from the
+// back of its own deque and steals from the front of the others, so the
+// ranges a thread was given stay local unless someone runs out of work.
+// The thread that calls parallel_for is one of them (deque 0), so a pool of
+// n threads starts n - 1 workers.
+class thread_pool
+{
+private:
+    struct job
+    {
+        void (*invoke)(void *, size_t, size_t);
+        void *fn;
+        std::atomic<size_t> remaining;
+    };
+
+    struct chunk
+    {
+        job *owner;
+        size_t begin, end;
+    };
+
+    struct worker_queue
+    {
+        std::mutex mut;
+        std::deque<chunk> chunks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex wake_mut;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{0};
+    bool pool_is_up = true;
+
+    bool pop_local(size_t id, chunk &c)
+    {
+        worker_queue &q = *queues[id];
+        std::lock_guard<std::mutex> lock(q.mut);
+        if (q.chunks.empty())
+            return false;
+        c = q.chunks.back();
+        q.chunks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, chunk &c)
+    {
+        for (size_t k = 1; k <= queues.size(); k++)
+        {
+            worker_queue &q = *queues[(thief + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mut);
+            if (!q.chunks.empty())
+            {
+                c = q.chunks.front();
+                q.chunks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool find_chunk(size_t id, chunk &c)
+    {
+        if (queued.load(std::memory_order_acquire) == 0)
+            return false;
+        if (pop_local(id, c) || steal(id, c))
+        {
+            queued.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+        return false;
+    }
+
+    static void run(const chunk &c)
+    {
+        c.owner->invoke(c.owner->fn, c.begin, c.end);
+        c.owner->remaining.fetch_sub(1, std::memory_order_release);
+    }
+
+    void worker_thread(size_t id)
+    {
+        chunk c;
+        while (true)
+        {
+            if (find_chunk(id, c))
+            {
+                run(c);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wake_mut);
+            wake.wait(lock, [this]() { return !pool_is_up || queued.load() > 0; });
+            if (!pool_is_up)
+                return;
+        }
+    }
+
+public:
+    explicit thread_pool(size_t num_threads = std::thread::hardware_concurrency())
+    {
+        if (num_threads == 0)
+            num_threads = 1;
+        for (size_t i = 0; i < num_threads; i++)
+            queues.emplace_back(new worker_queue);
+        for (size_t i = 1; i < num_threads; i++)
+            workers.emplace_back(&thread_pool::worker_thread, this, i);
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mut);
+            pool_is_up = false;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    // threads that run chunks, the caller included
+    size_t size() const { return queues.size(); }
+
+    // Calls fn(lo, hi) over [begin, end) in chunks of at most `grain`
+    // elements and returns when all of them are done. Consecutive chunks are
+    // dealt to the threads in contiguous runs, the caller's run included,
+    // and the caller keeps taking chunks until the range is finished.
+    template <typename Func>
+    void parallel_for(size_t begin, size_t end, size_t grain, Func &&fn)
+    {
+        if (begin >= end)
+            return;
+        if (grain == 0)
+            grain = 1;
+        size_t num_chunks = (end - begin + grain - 1) / grain;
+
+        // Func is F& for an lvalue functor
+        using F = std::remove_reference_t<Func>;
+        job j;
+        j.invoke = [](void *f, size_t lo, size_t hi) { (*static_cast<F *>(f))(lo, hi); };
+        j.fn = const_cast<void *>(static_cast<const void *>(&fn));
+        j.remaining.store(num_chunks, std::memory_order_relaxed);
+
+        // counted before any chunk is visible: a worker that pops one right
+        // away must not take `queued` below zero
+        queued.fetch_add(num_chunks, std::memory_order_release);
+
+        size_t per_worker = (num_chunks + queues.size() - 1) / queues.size();
+        for (size_t w = 0, k = 0; w < queues.size() && k < num_chunks; w++)
+        {
+            std::lock_guard<std::mutex> lock(queues[w]->mut);
+            for (size_t last = std::min(num_chunks, k + per_worker); k < last; k++)
+            {
+                size_t lo = begin + k * grain;
+                // pushed in reverse so the owner pops its run in order
+                queues[w]->chunks.push_front({&j, lo, std::min(end, lo + grain)});
+            }
+        }
+        {
+            // a worker between its predicate check and its wait holds the
+            // lock, so it can not miss this notify
+            std::lock_guard<std::mutex> lock(wake_mut);
+        }
+        wake.notify_all();
+
+        chunk c;
+        while (j.remaining.load(std::memory_order_acquire) > 0)
+        {
+            if (find_chunk(0, c))
+                run(c);
+            else
+                std::this_thread::yield();
+        }
+    }
+};
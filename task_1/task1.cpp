@@ -1,5 +1,7 @@
 #include <iostream>
+#include <algorithm>
 #include <cmath>
+#include <thread>
 #include <vector>
 
 
@@ -9,23 +11,135 @@
 #define TYPE double
 #endif
 
+#define STEPS 10000000
 
-int main(){
-    std::vector<float> vec;
-    TYPE step = powl(10, 7);
+// samples per block; every block re-seeds its lanes with exact sin/cos, so
+// the recurrence error never builds up over more than BLOCK / LANES steps
+#define BLOCK 1024
+#define LANES 8
+
+
+// Kahan-Babuska: the compensation also survives terms larger than the
+// running sum, which happens all the time once a period cancels out
+struct kahan_sum {
+    TYPE sum = 0;
+    TYPE c = 0;
 
+    void add(TYPE x){
+        TYPE t = sum + x;
+        if (std::fabs(sum) >= std::fabs(x)){
+            c += (sum - t) + x;
+        }
+        else {
+            c += (x - t) + sum;
+        }
+        sum = t;
+    }
 
+    TYPE result() const {
+        return sum + c;
+    }
+};
 
-    for (TYPE i = 0; i < step; i++){
-        vec.push_back(sin(2 * M_PI * i / step));
+// Sum of sin(2 * pi * i / n) for i in [first, first + count), returned as
+// the rounded sum plus its error in *low. Lane j starts
+// at sample first + j and advances by LANES samples per step through the
+// angle-addition formulas, so the lane loop vectorizes and no sample is
+// ever stored. The rotation runs in double even for float TYPE: in float
+// its phase error alone outweighs the sum; samples are rounded to TYPE
+// before they are added, each lane with its own Kahan compensation.
+TYPE block_sum(long first, long count, long n, TYPE *low){
+    double delta = 2 * M_PI / n;
+    double s[LANES], c[LANES];
+    TYPE acc[LANES], comp[LANES];
+    for (int j = 0; j < LANES; j++){
+        s[j] = std::sin(delta * (first + j));
+        c[j] = std::cos(delta * (first + j));
+        acc[j] = 0;
+        comp[j] = 0;
+    }
+    double rs = std::sin(delta * LANES);
+    double rc = std::cos(delta * LANES);
+
+    long steps = count / LANES;
+    for (long k = 0; k < steps; k++){
+        for (int j = 0; j < LANES; j++){
+            TYPE y = (TYPE)s[j] - comp[j];
+            TYPE t = acc[j] + y;
+            comp[j] = (t - acc[j]) - y;
+            acc[j] = t;
+            double next = s[j] * rc + c[j] * rs;
+            c[j] = c[j] * rc - s[j] * rs;
+            s[j] = next;
+        }
+    }
+    for (int j = 0; j < count % LANES; j++){
+        acc[j] += (TYPE)s[j];
+    }
+
+    // pairwise over the lanes; the rounding error of every addition goes
+    // to *low together with the lane compensations
+    TYPE err = 0;
+    for (int j = 0; j < LANES; j++){
+        err -= comp[j];
+    }
+    for (int w = LANES / 2; w > 0; w /= 2){
+        for (int j = 0; j < w; j++){
+            TYPE t = acc[j] + acc[j + w];
+            TYPE b = t - acc[j];
+            err += (acc[j] - (t - b)) + (acc[j + w] - b);
+            acc[j] = t;
+        }
+    }
+    *low = err;
+    return acc[0];
+}
+
+void range_sum(long lb, long ub, long n, kahan_sum *res){
+    kahan_sum sum;
+    for (long i = lb; i < ub; i += BLOCK){
+        TYPE low;
+        sum.add(block_sum(i, ub - i < BLOCK ? ub - i : BLOCK, n, &low));
+        sum.add(low);
+    }
+    *res = sum;
+}
+
+
+int main(){
+    long n = STEPS;
+    long num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0){
+        num_threads = 1;
+    }
+
+    // whole blocks per thread, the last one takes the remainder
+    long blocks = (n + BLOCK - 1) / BLOCK;
+    long blocks_per_thread = (blocks + num_threads - 1) / num_threads;
+
+    // a thread's sum can be much larger than the total, so both of its
+    // parts are merged rather than its rounded result
+    std::vector<kahan_sum> partial(num_threads);
+    std::vector<std::thread> threads;
+    for (long t = 0; t < num_threads; t++){
+        long lb = t * blocks_per_thread * BLOCK;
+        long ub = std::min(n, lb + blocks_per_thread * BLOCK);
+        if (lb >= ub){
+            break;
+        }
+        threads.emplace_back(range_sum, lb, ub, n, &partial[t]);
+    }
+    for (auto &thread : threads){
+        thread.join();
     }
 
-    TYPE sum;
-    for (TYPE num : vec){
-        sum += num;
+    kahan_sum sum;
+    for (const kahan_sum &p : partial){
+        sum.add(p.sum);
+        sum.add(p.c);
     }
 
-    std::cout << sum;
+    std::cout << sum.result();
 
     return 0;
-}
\ No newline at end of file
+}
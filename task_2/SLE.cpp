@@ -3,6 +3,7 @@
 #include <math.h>
 #include <time.h>
 #include <omp.h>
+#include "matrix_file.hpp"
 
 #define NUM_THREADS 40
 
@@ -21,13 +22,19 @@ void init_matrix(double *matrix, int n)
         for (int j = 0; j < n; j++)
         {
             if (i == j)
-                matrix[i * n + j] = 2.0;
+                matrix[(size_t)i * n + j] = 2.0;
             else
-                matrix[i * n + j] = 1.0;
+                matrix[(size_t)i * n + j] = 1.0;
         }
     }
 }
 
+// matrix_fill_func adapter for the cached matrix file
+void fill_sle_matrix(double *matrix, size_t, size_t n)
+{
+    init_matrix(matrix, n);
+}
+
 void matrix_vector_product(double *mx, double *vec, double *res, int n)
 {
 #pragma omp for
@@ -36,7 +43,7 @@ void matrix_vector_product(double *mx, double *vec, double *res, int n)
         int sum = 0;
         for (int j = 0; j < n; j++)
         {
-            sum += mx[i * n + j] * vec[j];
+            sum += mx[(size_t)i * n + j] * vec[j];
         }
         res[i] = sum;
     }
@@ -109,10 +116,12 @@ void simple_iteration(double *matrix, double *x, double *b, int n, double tau, d
 
 }
 
+// usage: sle.exe [n] [tau] [eps] [matrix file]
+// with a matrix file the matrix is generated once, then mapped from disk
 int main(int argc, char **argv)
 {
     int n = 20000;
-    
+
     if (argc > 1)
         n = atoi(argv[1]);
 
@@ -124,7 +133,22 @@ int main(int argc, char **argv)
     if (argc > 3)
         eps = atof(argv[3]);
 
-    double *matrix = (double *)calloc(n * n, sizeof(double *));
+    const char *matrix_path = argc > 4 ? argv[4] : NULL;
+
+    double *matrix;
+    if (matrix_path != NULL)
+    {
+        if (prepare_matrix_file(matrix_path, "sle", n, n, fill_sle_matrix) < 0)
+            return 1;
+        matrix = map_matrix_file(matrix_path, n, n);
+        if (matrix == NULL)
+            return 1;
+    }
+    else
+    {
+        matrix = (double *)calloc((size_t)n * n, sizeof(double));
+        init_matrix(matrix, n);
+    }
 
     double *x = (double *)calloc(n, sizeof(double));
 
@@ -133,13 +157,15 @@ int main(int argc, char **argv)
     {
         b[i] = n + 1;
     }
-    init_matrix(matrix, n);
 
     double t = cpuSecond();
     simple_iteration(matrix, x, b, n, tau, eps);
     t = cpuSecond() - t;
 
-    free(matrix);
+    if (matrix_path != NULL)
+        unmap_matrix_file(matrix, n, n);
+    else
+        free(matrix);
     free(x);
     free(b);
 
@@ -1,11 +1,27 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <math.h>
 #include <time.h>
 #include <omp.h>
+#include "matrix_file.hpp"
 
 #define NUM_THREADS 40
 
+#include "sle.hpp"
+
+// float can not resolve a correction much finer than this, the outer double
+// loop takes over from there
+#define INNER_EPS 1e-5
+#define MAX_INNER_ITERATIONS 1000000
+#define MAX_OUTER_ITERATIONS 100
+
+// tile of the block matvec: ROW_BLOCK x COL_BLOCK matrix elements are applied
+// to a COL_BLOCK x k panel of the right-hand sides that stays in cache
+#define ROW_BLOCK 32
+#define COL_BLOCK 256
+
 double cpuSecond()
 {
     struct timespec ts;
@@ -13,95 +29,227 @@ double cpuSecond()
     return ((double)ts.tv_sec + (double)ts.tv_nsec * 1.e-9);
 }
 
-void init_matrix(double *matrix, int n)
+// matrix_fill_func adapter for the cached matrix file
+void fill_sle_matrix(double *matrix, size_t, size_t n)
 {
-#pragma omp parallel for num_threads(NUM_THREADS)
-    for (int i = 0; i < n; i++)
+    init_matrix(matrix, n);
+}
+
+// Iterative refinement: the correction A*d = r is solved by simple iteration
+// on the float copy of the matrix, the residual r = A*x - b and the update
+// x -= d stay in double, so the result reaches the same eps as the double solver.
+// If float can not push the residual that far (ill-conditioned matrix, tight
+// eps) the loop stops once the residual no longer decreases or after
+// MAX_OUTER_ITERATIONS; *converged tells which way it ended.
+int simple_iteration_mixed(double *matrix, float *matrix_f, double *x, double *b, int n, double tau, double eps,
+                           int *converged)
+{
+    double *ax = (double *)malloc(n * sizeof(double));
+    double *r = (double *)malloc(n * sizeof(double));
+    float *r_f = (float *)malloc(n * sizeof(float));
+    float *d_f = (float *)malloc(n * sizeof(float));
+    double *d = (double *)malloc(n * sizeof(double));
+    double norm_b = find_norm(b, n);
+    double norm_r;
+    double prev_norm_r = HUGE_VAL;
+    int inner_iterations = 0;
+
+    *converged = 0;
+    for (int outer = 0; outer < MAX_OUTER_ITERATIONS; outer++)
     {
-        for (int j = 0; j < n; j++)
+        matrix_vector_product(matrix, x, ax, n);
+        vector_sub(ax, b, r, n);
+        norm_r = find_norm(r, n);
+        if (norm_r / norm_b < eps)
         {
-            if (i == j)
-                matrix[i * n + j] = 2.0;
-            else
-                matrix[i * n + j] = 1.0;
+            *converged = 1;
+            break;
         }
+        if (norm_r >= prev_norm_r)
+            break;
+        prev_norm_r = norm_r;
+
+        // reduce the residual only as far as eps needs and float allows
+        double inner_eps = fmax(eps * norm_b / norm_r, INNER_EPS);
+        convert_vector(r, r_f, n);
+        memset(d_f, 0, n * sizeof(float));
+        inner_iterations += simple_iteration(matrix_f, d_f, r_f, n, (float)tau, inner_eps, MAX_INNER_ITERATIONS);
+        convert_vector(d_f, d, n);
+        inplace_vector_sub(x, d, n);
     }
+
+    free(ax);
+    free(r);
+    free(r_f);
+    free(d_f);
+    free(d);
+    return inner_iterations;
 }
 
-void matrix_vector_product(double *mx, double *vec, double *res, int n)
+// AX = A * X for k columns at once, X and AX are n x k row-major, so every
+// matrix element is read once per call for all k systems
+void matrix_block_product(double *mx, double *X, double *res, int n, int k)
 {
-#pragma omp parallel for num_threads(NUM_THREADS)
-    for (int i = 0; i < n; i++)
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(static)
+    for (int ib = 0; ib < n; ib += ROW_BLOCK)
     {
-        int sum = 0;
-        for (int j = 0; j < n; j++)
+        int ie = ib + ROW_BLOCK < n ? ib + ROW_BLOCK : n;
+        memset(res + (size_t)ib * k, 0, (size_t)(ie - ib) * k * sizeof(double));
+        for (int jb = 0; jb < n; jb += COL_BLOCK)
         {
-            sum += mx[i * n + j] * vec[j];
+            int je = jb + COL_BLOCK < n ? jb + COL_BLOCK : n;
+            for (int i = ib; i < ie; i++)
+            {
+                double *__restrict row = res + (size_t)i * k;
+                for (int j = jb; j < je; j++)
+                {
+                    double a = mx[(size_t)i * n + j];
+                    const double *__restrict xj = X + (size_t)j * k;
+                    for (int c = 0; c < k; c++)
+                        row[c] += a * xj[c];
+                }
+            }
         }
-        res[i] = sum;
     }
 }
 
-void vector_sub(double *vec_1, double *vec_2, double *res, int n)
+// squared norm of every column of an n x k row-major block
+void find_column_norms(double *vec, double *norms, int n, int k)
 {
-#pragma omp parallel for num_threads(NUM_THREADS)
-    for (int i = 0; i < n; i++)
+    for (int c = 0; c < k; c++)
+        norms[c] = 0.0;
+#pragma omp parallel num_threads(NUM_THREADS)
     {
-        res[i] = vec_1[i] - vec_2[i];
+        double *local = (double *)calloc(k, sizeof(double));
+#pragma omp for
+        for (int i = 0; i < n; i++)
+        {
+            for (int c = 0; c < k; c++)
+                local[c] += vec[(size_t)i * k + c] * vec[(size_t)i * k + c];
+        }
+#pragma omp critical
+        for (int c = 0; c < k; c++)
+            norms[c] += local[c];
+        free(local);
     }
+    for (int c = 0; c < k; c++)
+        norms[c] = sqrt(norms[c]);
 }
 
-void inplace_vector_sub(double *vec_1, double *vec_2, int n)
+// Simple iteration for k right-hand sides. Convergence is tracked per column:
+// a converged column is frozen and the loop runs until every column is done.
+// Returns the number of matrix passes, iterations[c] gets the per-column count.
+int simple_iteration_block(double *matrix, double *X, double *B, int n, int k, double tau, double eps, int *iterations)
 {
-#pragma omp parallel for num_threads(NUM_THREADS)
-    for (int i = 0; i < n; i++)
+    double *ax = (double *)malloc((size_t)n * k * sizeof(double));
+    double *norm_b = (double *)malloc(k * sizeof(double));
+    double *norm_sub = (double *)malloc(k * sizeof(double));
+    char *active = (char *)malloc(k);
+    int num_active = k;
+    int passes = 0;
+
+    find_column_norms(B, norm_b, n, k);
+    for (int c = 0; c < k; c++)
     {
-        vec_1[i] -= vec_2[i];
+        active[c] = 1;
+        iterations[c] = 0;
     }
-}
 
-void vector_scalar_product(double *vec, double scale, int n)
-{
-#pragma omp parallel for num_threads(NUM_THREADS)
-    for (int i = 0; i < n; i++)
+    while (num_active > 0)
     {
-        vec[i] *= scale;
-    }
-}
+        matrix_block_product(matrix, X, ax, n, k);
+        passes++;
+#pragma omp parallel for num_threads(NUM_THREADS)
+        for (size_t i = 0; i < (size_t)n * k; i++)
+            ax[i] -= B[i];
+        find_column_norms(ax, norm_sub, n, k);
+
+        for (int c = 0; c < k; c++)
+        {
+            if (active[c] && norm_sub[c] / norm_b[c] < eps)
+            {
+                active[c] = 0;
+                num_active--;
+            }
+        }
 
-double find_norm(double *vec, int n)
-{
-    double norm = 0;
-    double sumloc = 0.0;
 #pragma omp parallel for num_threads(NUM_THREADS)
-    for (int i = 0; i < n; i++)
-    {
-        norm += pow(vec[i], 2);
+        for (int i = 0; i < n; i++)
+        {
+            for (int c = 0; c < k; c++)
+            {
+                if (active[c])
+                    X[(size_t)i * k + c] -= tau * ax[(size_t)i * k + c];
+            }
+        }
+        for (int c = 0; c < k; c++)
+            iterations[c] += active[c];
     }
-#pragma omp atomic
-    norm += sumloc;
-    return sqrt(norm);
+
+    free(ax);
+    free(norm_b);
+    free(norm_sub);
+    free(active);
+    return passes;
 }
 
-void simple_iteration(double *matrix, double *x, double *b, int n, double tau, double eps)
+// Simple iteration with the matrix read from its file on every pass, panel
+// by panel, for matrices that do not fit in memory. Returns the number of
+// iterations, -1 if the file could not be read.
+int simple_iteration_streamed(const char *path, double *x, double *b, int n, double tau, double eps,
+                              int max_iterations)
 {
     double *ax = (double *)malloc(n * sizeof(double));
     double *subs = (double *)malloc(n * sizeof(double));
     double norm_b = find_norm(b, n);
-    double norm_sub;
+    int iterations = 0;
 
-    while (1)
+    while (iterations < max_iterations)
     {
-        matrix_vector_product(matrix, x, ax, n);
+        int ok = stream_matrix_file(path, n, n,
+                                    [&](double *panel, size_t first, size_t rows)
+                                    {
+#pragma omp parallel for num_threads(NUM_THREADS)
+                                        for (size_t i = 0; i < rows; i++)
+                                        {
+                                            double sum = 0.0;
+                                            for (int j = 0; j < n; j++)
+                                                sum += panel[i * n + j] * x[j];
+                                            ax[first + i] = sum;
+                                        }
+                                    });
+        if (!ok)
+        {
+            iterations = -1;
+            break;
+        }
         vector_sub(ax, b, subs, n);
-        norm_sub = find_norm(subs, n);
-        if (norm_sub / norm_b < eps)
+        if (find_norm(subs, n) / norm_b < eps)
             break;
         vector_scalar_product(subs, tau, n);
         inplace_vector_sub(x, subs, n);
+        iterations++;
     }
+
+    free(ax);
+    free(subs);
+    return iterations;
 }
 
+double relative_residual(double *matrix, double *x, double *b, int n)
+{
+    double *ax = (double *)malloc(n * sizeof(double));
+    matrix_vector_product(matrix, x, ax, n);
+    inplace_vector_sub(ax, b, n);
+    double res = find_norm(ax, n) / find_norm(b, n);
+    free(ax);
+    return res;
+}
+
+// usage: sle2.exe [n] [tau] [eps] [double|mixed|block] [k] [matrix file] [mmap|stream]
+// with a matrix file the matrix is generated once, then mapped from disk;
+// with stream the double solve also runs with the matrix streamed from the
+// file on every iteration
 int main(int argc, char **argv)
 {
     int n = 1000;
@@ -117,7 +265,30 @@ int main(int argc, char **argv)
     if (argc > 3)
         eps = atof(argv[3]);
 
-    double *matrix = (double *)calloc(n * n, sizeof(double *));
+    int mixed = argc > 4 && strcmp(argv[4], "mixed") == 0;
+    int block = argc > 4 && strcmp(argv[4], "block") == 0;
+
+    int k = 16;
+    if (argc > 5)
+        k = atoi(argv[5]);
+
+    const char *matrix_path = argc > 6 ? argv[6] : NULL;
+    int stream = matrix_path != NULL && argc > 7 && strcmp(argv[7], "stream") == 0;
+
+    double *matrix;
+    if (matrix_path != NULL)
+    {
+        if (prepare_matrix_file(matrix_path, "sle", n, n, fill_sle_matrix) < 0)
+            return 1;
+        matrix = map_matrix_file(matrix_path, n, n);
+        if (matrix == NULL)
+            return 1;
+    }
+    else
+    {
+        matrix = (double *)calloc((size_t)n * n, sizeof(double));
+        init_matrix(matrix, n);
+    }
 
     double *x = (double *)calloc(n, sizeof(double));
 
@@ -126,13 +297,122 @@ int main(int argc, char **argv)
     {
         b[i] = n + 1;
     }
-    init_matrix(matrix, n);
 
     double t = cpuSecond();
-    simple_iteration(matrix, x, b, n, tau, eps);
+    int iterations = simple_iteration(matrix, x, b, n, tau, eps, INT_MAX);
     t = cpuSecond() - t;
 
     printf("Elapsed time (serial): %.6f sec.\n", t);
 
+    if (stream)
+    {
+        double *x_stream = (double *)calloc(n, sizeof(double));
+        double t_stream = cpuSecond();
+        int stream_iterations = simple_iteration_streamed(matrix_path, x_stream, b, n, tau, eps, INT_MAX);
+        t_stream = cpuSecond() - t_stream;
+        if (stream_iterations < 0)
+        {
+            printf("Error reading %s!\n", matrix_path);
+            return 1;
+        }
+        printf("Elapsed time (streamed): %.6f sec. (%d iterations, in memory %d)\n", t_stream, stream_iterations,
+               iterations);
+        printf("Residual (streamed): %e\n", relative_residual(matrix, x_stream, b, n));
+        free(x_stream);
+    }
+
+    if (mixed)
+    {
+        printf("Double iterations: %d\n", iterations);
+        printf("Residual (double): %e\n", relative_residual(matrix, x, b, n));
+
+        double *x_mixed = (double *)calloc(n, sizeof(double));
+        double t_mixed = cpuSecond();
+        // the float copy is part of the mixed solver's cost
+        float *matrix_f = (float *)malloc((size_t)n * n * sizeof(float));
+        convert_vector(matrix, matrix_f, (size_t)n * n);
+        int converged;
+        int inner = simple_iteration_mixed(matrix, matrix_f, x_mixed, b, n, tau, eps, &converged);
+        t_mixed = cpuSecond() - t_mixed;
+
+        if (!converged)
+            printf("Mixed solver did not converge to eps %e\n", eps);
+        printf("Elapsed time (mixed): %.6f sec. (%d float iterations)\n", t_mixed, inner);
+        printf("Residual (mixed): %e\n", relative_residual(matrix, x_mixed, b, n));
+        printf("Speedup (mixed vs double): %.3f\n", t / t_mixed);
+
+        free(matrix_f);
+        free(x_mixed);
+    }
+
+    if (block)
+    {
+        // independent right-hand sides, so the columns converge after
+        // different numbers of iterations. Unlike b = const they have parts
+        // along the eigenvalue 1, so they need tau near 2 / (n + 2), e.g.
+        // sle2.exe 300 0.0066 0.00001 block 4
+        double *X = (double *)calloc((size_t)n * k, sizeof(double));
+        double *B = (double *)malloc((size_t)n * k * sizeof(double));
+        int *column_iterations = (int *)malloc(k * sizeof(int));
+        for (int i = 0; i < n; i++)
+        {
+            for (int c = 0; c < k; c++)
+                B[(size_t)i * k + c] = (n + 1) * (1.0 + 0.1 / (c + 1) * sin(0.37 * i * (c + 1) + c));
+        }
+
+        double t_block = cpuSecond();
+        int passes = simple_iteration_block(matrix, X, B, n, k, tau, eps, column_iterations);
+        t_block = cpuSecond() - t_block;
+
+        // the same k systems solved one by one, each column of X has to
+        // match its single solve
+        double *x_single = (double *)malloc(n * sizeof(double));
+        double *b_single = (double *)malloc(n * sizeof(double));
+        double t_single = 0.0;
+        double max_error = 0.0;
+        for (int c = 0; c < k; c++)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                b_single[i] = B[(size_t)i * k + c];
+                x_single[i] = 0.0;
+            }
+            double t_c = cpuSecond();
+            int single_iterations = simple_iteration(matrix, x_single, b_single, n, tau, eps, INT_MAX);
+            t_single += cpuSecond() - t_c;
+
+            double diff = 0.0, norm = 0.0;
+            for (int i = 0; i < n; i++)
+            {
+                double d = X[(size_t)i * k + c] - x_single[i];
+                diff += d * d;
+                norm += x_single[i] * x_single[i];
+            }
+            double error = sqrt(diff / norm);
+            if (error > max_error)
+                max_error = error;
+            printf("column %d: %d iterations (single solve %d), relative error %e\n", c, column_iterations[c],
+                   single_iterations, error);
+        }
+
+        printf("Elapsed time (block, k=%d): %.6f sec. (%d matrix passes)\n", k, t_block, passes);
+        printf("Elapsed time (%d single solves): %.6f sec.\n", k, t_single);
+        printf("Max relative error (block vs single): %e\n", max_error);
+        printf("Speedup (block vs %d single solves): %.3f\n", k, t_single / t_block);
+
+        free(x_single);
+        free(b_single);
+        free(X);
+        free(B);
+        free(column_iterations);
+    }
+
+    if (matrix_path != NULL)
+        unmap_matrix_file(matrix, n, n);
+    else
+        free(matrix);
+    free(x);
+    free(b);
+
     return 0;
-}
\ No newline at end of file
+}
@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <omp.h>
+#include "matrix_file.hpp"
 
 #ifndef NUM_THREADS
 #define NUM_THREADS 40
@@ -16,6 +18,61 @@
 #define TYPE static
 #endif
 
+#ifndef SCHEDULE_CACHE
+#define SCHEDULE_CACHE "schedule.cache"
+#endif
+
+// how many times every candidate is timed before the tuner picks a winner
+#define TUNE_REPEATS 3
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+enum kernel_id
+{
+    K_MATVEC,
+    K_SUB,
+    K_INPLACE_SUB,
+    K_SCALE,
+    K_NORM,
+    K_COUNT
+};
+
+static const char *kernel_names[K_COUNT] = {"matvec", "sub", "inplace_sub", "scale", "norm"};
+
+typedef struct
+{
+    omp_sched_t kind;
+    int chunk;
+} schedule_t;
+
+// chunk 0 means "implementation default" for omp_set_schedule
+static const schedule_t candidates[] = {
+    {omp_sched_static, 0},
+    {omp_sched_static, 20},
+    {omp_sched_static, 100},
+    {omp_sched_dynamic, 20},
+    {omp_sched_dynamic, 100},
+    {omp_sched_dynamic, 1000},
+    {omp_sched_guided, 20},
+    {omp_sched_guided, 100},
+};
+
+#define NUM_CANDIDATES (int)(sizeof(candidates) / sizeof(candidates[0]))
+
+typedef struct
+{
+    schedule_t best;
+    int tuning;
+    int calls;
+    double time[NUM_CANDIDATES];
+} kernel_tuner;
+
+static kernel_tuner tuners[K_COUNT];
+static schedule_t default_schedule;
+static int problem_size;
+static char cpu_model[256] = "unknown";
+
 double cpuSecond()
 {
     struct timespec ts;
@@ -23,73 +80,230 @@ double cpuSecond()
     return ((double)ts.tv_sec + (double)ts.tv_nsec * 1.e-9);
 }
 
+const char *schedule_name(omp_sched_t kind)
+{
+    switch (kind)
+    {
+    case omp_sched_static:
+        return "static";
+    case omp_sched_dynamic:
+        return "dynamic";
+    case omp_sched_guided:
+        return "guided";
+    default:
+        return "auto";
+    }
+}
+
+int parse_schedule(const char *name, omp_sched_t *kind)
+{
+    if (strcmp(name, "static") == 0)
+        *kind = omp_sched_static;
+    else if (strcmp(name, "dynamic") == 0)
+        *kind = omp_sched_dynamic;
+    else if (strcmp(name, "guided") == 0)
+        *kind = omp_sched_guided;
+    else if (strcmp(name, "auto") == 0)
+        *kind = omp_sched_auto;
+    else
+        return 0;
+    return 1;
+}
+
+void read_cpu_model()
+{
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL)
+        return;
+    char line[512];
+    while (fgets(line, sizeof(line), f))
+    {
+        if (strncmp(line, "model name", 10) == 0)
+        {
+            char *value = strchr(line, ':');
+            if (value != NULL)
+            {
+                value += 2;
+                value[strcspn(value, "\n")] = '\0';
+                snprintf(cpu_model, sizeof(cpu_model), "%s", value);
+            }
+            break;
+        }
+    }
+    fclose(f);
+}
+
+// cache line: <kernel> <n> <threads> <kind> <chunk> <cpu model>
+// later lines override earlier ones, so a retune simply appends
+void load_schedule_cache()
+{
+    FILE *f = fopen(SCHEDULE_CACHE, "r");
+    if (f == NULL)
+        return;
+    char line[512], kernel[32], kind[16], model[256];
+    int n, threads, chunk;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "%31s %d %d %15s %d %255[^\n]", kernel, &n, &threads, kind, &chunk, model) != 6)
+            continue;
+        if (n != problem_size || threads != NUM_THREADS || strcmp(model, cpu_model) != 0)
+            continue;
+        for (int k = 0; k < K_COUNT; k++)
+        {
+            if (strcmp(kernel, kernel_names[k]) == 0 && parse_schedule(kind, &tuners[k].best.kind))
+            {
+                tuners[k].best.chunk = chunk;
+                tuners[k].tuning = 0;
+            }
+        }
+    }
+    fclose(f);
+}
+
+void save_schedule(int k)
+{
+    FILE *f = fopen(SCHEDULE_CACHE, "a");
+    if (f == NULL)
+        return;
+    fprintf(f, "%s %d %d %s %d %s\n", kernel_names[k], problem_size, NUM_THREADS,
+            schedule_name(tuners[k].best.kind), tuners[k].best.chunk, cpu_model);
+    fclose(f);
+}
+
+void init_schedules(int n, omp_sched_t kind, int chunk, int autotune)
+{
+    problem_size = n;
+    default_schedule.kind = kind;
+    default_schedule.chunk = chunk;
+    for (int k = 0; k < K_COUNT; k++)
+    {
+        tuners[k].best = default_schedule;
+        tuners[k].tuning = autotune;
+        tuners[k].calls = 0;
+        for (int c = 0; c < NUM_CANDIDATES; c++)
+            tuners[k].time[c] = 0.0;
+    }
+    if (autotune)
+    {
+        read_cpu_model();
+        load_schedule_cache();
+    }
+}
+
+// While a kernel is tuning, its calls cycle through the candidates
+// and the winner is fixed after TUNE_REPEATS rounds.
+double schedule_begin(int k)
+{
+    kernel_tuner *tn = &tuners[k];
+    schedule_t s = tn->tuning ? candidates[tn->calls % NUM_CANDIDATES] : tn->best;
+    omp_set_schedule(s.kind, s.chunk);
+    return tn->tuning ? cpuSecond() : 0.0;
+}
+
+void schedule_end(int k, double start)
+{
+    kernel_tuner *tn = &tuners[k];
+    if (!tn->tuning)
+        return;
+    tn->time[tn->calls % NUM_CANDIDATES] += cpuSecond() - start;
+    if (++tn->calls < NUM_CANDIDATES * TUNE_REPEATS)
+        return;
+
+    int best = 0;
+    for (int c = 1; c < NUM_CANDIDATES; c++)
+    {
+        if (tn->time[c] < tn->time[best])
+            best = c;
+    }
+    tn->best = candidates[best];
+    tn->tuning = 0;
+    save_schedule(k);
+}
+
+void print_schedules()
+{
+    for (int k = 0; k < K_COUNT; k++)
+    {
+        fprintf(stderr, "%-12s schedule(%s, %d)%s\n", kernel_names[k], schedule_name(tuners[k].best.kind),
+                tuners[k].best.chunk, tuners[k].tuning ? " [tuning unfinished]" : "");
+    }
+}
+
 void init_matrix(double *matrix, int n)
 {
-#pragma omp parallel for  num_threads(NUM_THREADS) schedule(TYPE, CHUNCK_SIZE)    
-for (int i = 0; i < n; i++)
+    omp_set_schedule(default_schedule.kind, default_schedule.chunk);
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(runtime)
+    for (int i = 0; i < n; i++)
     {
         for (int j = 0; j < n; j++)
         {
             if (i == j)
-                matrix[i * n + j] = 2.0;
+                matrix[(size_t)i * n + j] = 2.0;
             else
-                matrix[i * n + j] = 1.0;
+                matrix[(size_t)i * n + j] = 1.0;
         }
     }
 }
 
 void matrix_vector_product(double *mx, double *vec, double *res, int n)
 {
-#pragma omp parallel for  num_threads(NUM_THREADS) schedule(TYPE, CHUNCK_SIZE) 
+    double t = schedule_begin(K_MATVEC);
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(runtime)
     for (int i = 0; i < n; i++)
     {
-        int sum = 0;
+        double sum = 0;
         for (int j = 0; j < n; j++)
         {
-            sum += mx[i * n + j] * vec[j];
+            sum += mx[(size_t)i * n + j] * vec[j];
         }
         res[i] = sum;
     }
+    schedule_end(K_MATVEC, t);
 }
 
 void vector_sub(double *vec_1, double *vec_2, double *res, int n)
 {
-#pragma omp parallel for  num_threads(NUM_THREADS) schedule(TYPE, CHUNCK_SIZE)     
-for (int i = 0; i < n; i++)
+    double t = schedule_begin(K_SUB);
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(runtime)
+    for (int i = 0; i < n; i++)
     {
         res[i] = vec_1[i] - vec_2[i];
     }
+    schedule_end(K_SUB, t);
 }
 
 void inplace_vector_sub(double *vec_1, double *vec_2, int n)
 {
-#pragma omp parallel for  num_threads(NUM_THREADS) schedule(TYPE, CHUNCK_SIZE)     
-for (int i = 0; i < n; i++)
+    double t = schedule_begin(K_INPLACE_SUB);
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(runtime)
+    for (int i = 0; i < n; i++)
     {
         vec_1[i] -= vec_2[i];
     }
+    schedule_end(K_INPLACE_SUB, t);
 }
 
 void vector_scalar_product(double *vec, double scale, int n)
 {
-#pragma omp parallel for  num_threads(NUM_THREADS) schedule(TYPE, CHUNCK_SIZE)     
-for (int i = 0; i < n; i++)
+    double t = schedule_begin(K_SCALE);
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(runtime)
+    for (int i = 0; i < n; i++)
     {
         vec[i] *= scale;
     }
+    schedule_end(K_SCALE, t);
 }
 
 double find_norm(double *vec, int n)
 {
     double norm = 0;
-    double sumloc = 0.0;
-#pragma omp parallel for  num_threads(NUM_THREADS) schedule(TYPE, CHUNCK_SIZE)     
-for (int i = 0; i < n; i++)
+    double t = schedule_begin(K_NORM);
+#pragma omp parallel for num_threads(NUM_THREADS) schedule(runtime) reduction(+ : norm)
+    for (int i = 0; i < n; i++)
     {
         norm += pow(vec[i], 2);
     }
-#pragma omp atomic
-    norm += sumloc;
+    schedule_end(K_NORM, t);
     return sqrt(norm);
 }
 
@@ -117,11 +331,20 @@ void simple_iteration(double *matrix, double *x, double *b, int n, double tau, d
 
 }
 
+// matrix_fill_func adapter for the cached matrix file
+void fill_sle_matrix(double *matrix, size_t, size_t n)
+{
+    init_matrix(matrix, n);
+}
+
+// usage: sle3.exe [n] [tau] [eps] [static|dynamic|guided|auto|tune] [chunk] [matrix file]
+// with a matrix file the matrix is generated once, then mapped from disk, so
+// repeated runs only time the solver
 int main(int argc, char **argv)
 {
     int n = 20000;
 
-    
+
     if (argc > 1)
         n = atoi(argv[1]);
 
@@ -133,7 +356,42 @@ int main(int argc, char **argv)
     if (argc > 3)
         eps = atof(argv[3]);
 
-    double *matrix = (double *)calloc(n * n, sizeof(double *));
+    omp_sched_t kind = omp_sched_static;
+    parse_schedule(XSTR(TYPE), &kind);
+    int autotune = 0;
+    if (argc > 4)
+    {
+        if (strcmp(argv[4], "tune") == 0)
+            autotune = 1;
+        else if (!parse_schedule(argv[4], &kind))
+        {
+            fprintf(stderr, "Unknown schedule: %s\n", argv[4]);
+            return 1;
+        }
+    }
+
+    int chunk = CHUNCK_SIZE;
+    if (argc > 5)
+        chunk = atoi(argv[5]);
+
+    init_schedules(n, kind, chunk, autotune);
+
+    const char *matrix_path = argc > 6 ? argv[6] : NULL;
+
+    double *matrix;
+    if (matrix_path != NULL)
+    {
+        if (prepare_matrix_file(matrix_path, "sle", n, n, fill_sle_matrix) < 0)
+            return 1;
+        matrix = map_matrix_file(matrix_path, n, n);
+        if (matrix == NULL)
+            return 1;
+    }
+    else
+    {
+        matrix = (double *)calloc((size_t)n * n, sizeof(double));
+        init_matrix(matrix, n);
+    }
 
     double *x = (double *)calloc(n, sizeof(double));
 
@@ -142,17 +400,22 @@ int main(int argc, char **argv)
     {
         b[i] = n + 1;
     }
-    init_matrix(matrix, n);
 
     double t = cpuSecond();
     simple_iteration(matrix, x, b, n, tau, eps);
     t = cpuSecond() - t;
 
-    free(matrix);
+    if (autotune)
+        print_schedules();
+
+    if (matrix_path != NULL)
+        unmap_matrix_file(matrix, n, n);
+    else
+        free(matrix);
     free(x);
     free(b);
 
     printf("%.6f\n", t);
 
     return 0;
-}
\ No newline at end of file
+}
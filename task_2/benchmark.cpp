@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <omp.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dgemv.hpp"
+#include "integration.hpp"
+#include "sle.hpp"
+#include "../task3/dgemv_threads.hpp"
+
+// Scaling benchmark for the task_2 and task3 kernels. Every kernel is run
+// for each size and thread count with warm-ups and repeated trials; the
+// median time gives speedup and efficiency relative to the first thread
+// count. Results go to stdout, optionally to CSV/JSON, and can be checked
+// against a CSV written by an earlier run.
+//
+// usage: benchmark.exe [--threads 1,2,4] [--kernels dgemv_omp,dgemv_threads,dgemv_spawn,integrate,sle]
+//                      [--dgemv-sizes 20000,40000] [--integrate-steps 40000000] [--sle-sizes 5000]
+//                      [--warmup 1] [--trials 5] [--csv file] [--json file]
+//                      [--baseline file] [--tolerance 0.1]
+
+struct options
+{
+    std::vector<size_t> threads;
+    std::vector<std::string> kernels = {"dgemv_omp", "dgemv_threads", "dgemv_spawn", "integrate", "sle"};
+    std::vector<size_t> dgemv_sizes = {20000, 40000};
+    std::vector<size_t> integrate_steps = {40000000};
+    std::vector<size_t> sle_sizes = {5000};
+    int warmup = 1;
+    int trials = 5;
+    const char *csv = NULL;
+    const char *json = NULL;
+    const char *baseline = NULL;
+    double tolerance = 0.1;
+};
+
+struct work
+{
+    double flops;
+    double bytes;
+};
+
+struct bench_result
+{
+    std::string kernel;
+    size_t size;
+    size_t threads;
+    double median;
+    double min;
+    double speedup;
+    double efficiency;
+    double gflops;
+    double gbs;
+};
+
+double cpuSecond()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ((double)ts.tv_sec + (double)ts.tv_nsec * 1.e-9);
+}
+
+double gauss(double x)
+{
+    return exp(-x * x);
+}
+
+std::vector<size_t> parse_list(const char *list)
+{
+    std::vector<size_t> values;
+    while (*list != '\0')
+    {
+        char *end;
+        size_t value = strtoull(list, &end, 10);
+        if (end == list)
+            break;
+        values.push_back(value);
+        list = (*end == ',') ? end + 1 : end;
+    }
+    return values;
+}
+
+std::vector<std::string> parse_names(const char *list)
+{
+    std::vector<std::string> names;
+    std::string cur;
+    for (const char *p = list;; p++)
+    {
+        if (*p == ',' || *p == '\0')
+        {
+            if (!cur.empty())
+                names.push_back(cur);
+            cur.clear();
+            if (*p == '\0')
+                break;
+        }
+        else
+            cur += *p;
+    }
+    return names;
+}
+
+bool enabled(const options &opt, const char *kernel)
+{
+    return std::find(opt.kernels.begin(), opt.kernels.end(), kernel) != opt.kernels.end();
+}
+
+// body(threads) runs the kernel once and returns the work it did
+void measure(const char *kernel, size_t size, const options &opt, std::function<work(size_t)> body,
+             std::vector<bench_result> &results)
+{
+    double base = 0.0;
+    size_t base_threads = 1;
+    for (size_t t : opt.threads)
+    {
+        for (int w = 0; w < opt.warmup; w++)
+            body(t);
+
+        std::vector<double> times;
+        work done = {0.0, 0.0};
+        for (int r = 0; r < opt.trials; r++)
+        {
+            double start = cpuSecond();
+            done = body(t);
+            times.push_back(cpuSecond() - start);
+        }
+        std::sort(times.begin(), times.end());
+        double median = times[times.size() / 2];
+        if (results.empty() || results.back().kernel != kernel || results.back().size != size)
+        {
+            base = median;
+            base_threads = t;
+        }
+
+        bench_result res;
+        res.kernel = kernel;
+        res.size = size;
+        res.threads = t;
+        res.median = median;
+        res.min = times[0];
+        res.speedup = base / median;
+        res.efficiency = res.speedup * base_threads / t;
+        res.gflops = done.flops / median * 1e-9;
+        res.gbs = done.bytes / median * 1e-9;
+        results.push_back(res);
+
+        printf("%-14s %10zu %4zu threads: %.6f sec. speedup %6.3f efficiency %5.3f %8.3f GFLOP/s %8.3f GB/s\n",
+               kernel, size, t, median, res.speedup, res.efficiency, res.gflops, res.gbs);
+        fflush(stdout);
+    }
+}
+
+void bench_dgemv(const options &opt, std::vector<bench_result> &results)
+{
+    for (size_t n : opt.dgemv_sizes)
+    {
+        double *a = (double *)malloc(sizeof(double) * n * n);
+        double *b = (double *)malloc(sizeof(double) * n);
+        double *c = (double *)malloc(sizeof(double) * n);
+        if (a == NULL || b == NULL || c == NULL)
+        {
+            free(a);
+            free(b);
+            free(c);
+            printf("Error allocate memory for n=%zu!\n", n);
+            continue;
+        }
+
+#pragma omp parallel for
+        for (size_t i = 0; i < n; i++)
+        {
+            for (size_t j = 0; j < n; j++)
+                a[i * n + j] = i + j;
+        }
+        for (size_t j = 0; j < n; j++)
+            b[j] = j;
+
+        work w = {2.0 * n * n, sizeof(double) * (n * n + 2.0 * n)};
+        if (enabled(opt, "dgemv_omp"))
+        {
+            measure("dgemv_omp", n, opt, [&](size_t t)
+                    {
+                        omp_set_num_threads(t);
+                        matrix_vector_product_omp(a, b, c, n, n);
+                        return w; },
+                    results);
+        }
+        free(a);
+        free(b);
+        free(c);
+
+        if (enabled(opt, "dgemv_threads"))
+        {
+            std::vector<double> vec(n, 1.0), matrix(n * n, 1.0);
+            std::unique_ptr<thread_pool> pool;
+            measure("dgemv_threads", n, opt, [&](size_t t)
+                    {
+                        if (!pool || pool->size() != t)
+                            pool.reset(new thread_pool(t));
+                        multiply_vector_matrix(vec, matrix, *pool);
+                        return w; },
+                    results);
+        }
+        if (enabled(opt, "dgemv_spawn"))
+        {
+            std::vector<double> vec(n, 1.0), matrix(n * n, 1.0);
+            measure("dgemv_spawn", n, opt, [&](size_t t)
+                    {
+                        multiply_vector_matrix_spawn(vec, matrix, t);
+                        return w; },
+                    results);
+        }
+    }
+}
+
+void bench_integrate(const options &opt, std::vector<bench_result> &results)
+{
+    for (size_t steps : opt.integrate_steps)
+    {
+        // a + h * (i + 0.5), -x * x and the sum; exp is not counted
+        work w = {5.0 * steps, 0.0};
+        measure("integrate", steps, opt, [&](size_t t)
+                {
+                    integrate_omp(gauss, -4.0, 4.0, steps, t);
+                    return w; },
+                results);
+    }
+}
+
+void bench_sle(const options &opt, std::vector<bench_result> &results)
+{
+    for (size_t n : opt.sle_sizes)
+    {
+        double *matrix = (double *)malloc(sizeof(double) * n * n);
+        double *x = (double *)malloc(sizeof(double) * n);
+        double *b = (double *)malloc(sizeof(double) * n);
+        if (matrix == NULL || x == NULL || b == NULL)
+        {
+            free(matrix);
+            free(x);
+            free(b);
+            printf("Error allocate memory for n=%zu!\n", n);
+            continue;
+        }
+        init_matrix(matrix, n);
+        for (size_t i = 0; i < n; i++)
+            b[i] = n + 1;
+        // same contraction per step as the task's tau = 2.5e-6 at n = 20000
+        double tau = 0.05 / (n + 1);
+
+        measure("sle", n, opt, [&](size_t t)
+                {
+                    omp_set_num_threads(t);
+                    memset(x, 0, sizeof(double) * n);
+                    int iterations = simple_iteration(matrix, x, b, (int)n, tau, 0.00001, INT_MAX);
+                    // per iteration: one matvec, sub, norm, scale and update
+                    work w = {iterations * (2.0 * n * n + 6.0 * n), iterations * sizeof(double) * (n * n + 7.0 * n)};
+                    return w; },
+                results);
+
+        free(matrix);
+        free(x);
+        free(b);
+    }
+}
+
+void write_csv(const char *path, const std::vector<bench_result> &results)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror(path);
+        return;
+    }
+    fprintf(f, "kernel,size,threads,median_s,min_s,speedup,efficiency,gflops,gbs\n");
+    for (const bench_result &r : results)
+    {
+        fprintf(f, "%s,%zu,%zu,%.6f,%.6f,%.4f,%.4f,%.4f,%.4f\n", r.kernel.c_str(), r.size, r.threads, r.median,
+                r.min, r.speedup, r.efficiency, r.gflops, r.gbs);
+    }
+    fclose(f);
+}
+
+void write_json(const char *path, const std::vector<bench_result> &results)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror(path);
+        return;
+    }
+    fprintf(f, "[\n");
+    for (size_t k = 0; k < results.size(); k++)
+    {
+        const bench_result &r = results[k];
+        fprintf(f,
+                "  {\"kernel\": \"%s\", \"size\": %zu, \"threads\": %zu, \"median_s\": %.6f, \"min_s\": %.6f, "
+                "\"speedup\": %.4f, \"efficiency\": %.4f, \"gflops\": %.4f, \"gbs\": %.4f}%s\n",
+                r.kernel.c_str(), r.size, r.threads, r.median, r.min, r.speedup, r.efficiency, r.gflops, r.gbs,
+                k + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+    fclose(f);
+}
+
+// Compares median times with a CSV from write_csv. Returns the number of
+// entries slower than baseline * (1 + tolerance).
+int check_baseline(const char *path, double tolerance, const std::vector<bench_result> &results)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    int regressions = 0;
+    char line[512], kernel[64];
+    size_t size, threads;
+    double median;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "%63[^,],%zu,%zu,%lf", kernel, &size, &threads, &median) != 4)
+            continue;
+        for (const bench_result &r : results)
+        {
+            if (r.kernel == kernel && r.size == size && r.threads == threads && r.median > median * (1.0 + tolerance))
+            {
+                printf("REGRESSION %s size %zu threads %zu: %.6f sec. vs baseline %.6f sec.\n", kernel, size, threads,
+                       r.median, median);
+                regressions++;
+            }
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    options opt;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const char *key = argv[i], *value = argv[i + 1];
+        if (strcmp(key, "--threads") == 0)
+            opt.threads = parse_list(value);
+        else if (strcmp(key, "--kernels") == 0)
+            opt.kernels = parse_names(value);
+        else if (strcmp(key, "--dgemv-sizes") == 0)
+            opt.dgemv_sizes = parse_list(value);
+        else if (strcmp(key, "--integrate-steps") == 0)
+            opt.integrate_steps = parse_list(value);
+        else if (strcmp(key, "--sle-sizes") == 0)
+            opt.sle_sizes = parse_list(value);
+        else if (strcmp(key, "--warmup") == 0)
+            opt.warmup = atoi(value);
+        else if (strcmp(key, "--trials") == 0)
+            opt.trials = atoi(value) > 0 ? atoi(value) : 1;
+        else if (strcmp(key, "--csv") == 0)
+            opt.csv = value;
+        else if (strcmp(key, "--json") == 0)
+            opt.json = value;
+        else if (strcmp(key, "--baseline") == 0)
+            opt.baseline = value;
+        else if (strcmp(key, "--tolerance") == 0)
+            opt.tolerance = atof(value);
+        else
+        {
+            printf("Unknown option %s\n", key);
+            return 2;
+        }
+    }
+    if (opt.threads.empty())
+    {
+        size_t procs = omp_get_num_procs();
+        for (size_t t = 1; t < procs; t *= 2)
+            opt.threads.push_back(t);
+        opt.threads.push_back(procs);
+    }
+
+    std::vector<bench_result> results;
+    if (enabled(opt, "dgemv_omp") || enabled(opt, "dgemv_threads") || enabled(opt, "dgemv_spawn"))
+        bench_dgemv(opt, results);
+    if (enabled(opt, "integrate"))
+        bench_integrate(opt, results);
+    if (enabled(opt, "sle"))
+        bench_sle(opt, results);
+
+    if (opt.csv != NULL)
+        write_csv(opt.csv, results);
+    if (opt.json != NULL)
+        write_json(opt.json, results);
+    if (opt.baseline != NULL && check_baseline(opt.baseline, opt.tolerance, results) > 0)
+        return 1;
+
+    return 0;
+}
@@ -1,11 +1,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <math.h>
+#include <string.h>
 #include <omp.h>
+#include <immintrin.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "matrix_file.hpp"
 
 #define MATRIX_SIZE 20000
 #define NUM_THREADS 40
 
+#include "dgemv.hpp"
+
+// columns per tile of the transposed product, the tile of the partial
+// result (16 KB) stays in L1 while all rows of a thread stream through it
+#define TILE_COLS 2048
+
+#define MAX_NODES 64
+#define MAX_CPUS 1024
+
+typedef struct
+{
+    int ncpus;
+    int cpus[MAX_CPUS];
+} numa_node;
+
+enum storage_format
+{
+    FMT_FP32,
+    FMT_BF16,
+    FMT_INT8
+};
+
+enum matrix_layout
+{
+    ROW_MAJOR,
+    COL_MAJOR
+};
+
 double cpuSecond()
 {
     struct timespec ts;
@@ -13,32 +48,317 @@ double cpuSecond()
     return ((double)ts.tv_sec + (double)ts.tv_nsec * 1.e-9);
 }
 
-void matrix_vector_product(double *a, double *b, double *c, int m, int n)
+// Register-blocked kernels for rows [lb, ub): several rows are processed per
+// pass, every chunk of b is loaded once for all of them and the partial sums
+// stay in vector registers until the row block is finished.
+typedef void (*dgemv_rows_func)(const double *a, const double *b, double *c, size_t lb, size_t ub, size_t n);
+
+void dgemv_rows_scalar(const double *a, const double *b, double *c, size_t lb, size_t ub, size_t n)
+{
+    for (size_t i = lb; i < ub; i++)
+    {
+        double sum = 0.0;
+        for (size_t j = 0; j < n; j++)
+            sum += a[i * n + j] * b[j];
+        c[i] = sum;
+    }
+}
+
+__attribute__((target("avx2,fma"))) static inline double hsum_avx2(__m256d v)
+{
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+// 4 rows x 2 vectors: 8 independent FMA chains
+__attribute__((target("avx2,fma"))) void dgemv_rows_avx2(const double *a, const double *b, double *c, size_t lb, size_t ub, size_t n)
+{
+    size_t i = lb;
+    for (; i + 4 <= ub; i += 4)
+    {
+        const double *a0 = a + i * n, *a1 = a0 + n, *a2 = a1 + n, *a3 = a2 + n;
+        __m256d s00 = _mm256_setzero_pd(), s01 = _mm256_setzero_pd();
+        __m256d s10 = _mm256_setzero_pd(), s11 = _mm256_setzero_pd();
+        __m256d s20 = _mm256_setzero_pd(), s21 = _mm256_setzero_pd();
+        __m256d s30 = _mm256_setzero_pd(), s31 = _mm256_setzero_pd();
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8)
+        {
+            __m256d b0 = _mm256_loadu_pd(b + j);
+            __m256d b1 = _mm256_loadu_pd(b + j + 4);
+            s00 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j), b0, s00);
+            s01 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j + 4), b1, s01);
+            s10 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j), b0, s10);
+            s11 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j + 4), b1, s11);
+            s20 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j), b0, s20);
+            s21 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j + 4), b1, s21);
+            s30 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j), b0, s30);
+            s31 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j + 4), b1, s31);
+        }
+        double r0 = hsum_avx2(_mm256_add_pd(s00, s01));
+        double r1 = hsum_avx2(_mm256_add_pd(s10, s11));
+        double r2 = hsum_avx2(_mm256_add_pd(s20, s21));
+        double r3 = hsum_avx2(_mm256_add_pd(s30, s31));
+        for (; j < n; j++)
+        {
+            r0 += a0[j] * b[j];
+            r1 += a1[j] * b[j];
+            r2 += a2[j] * b[j];
+            r3 += a3[j] * b[j];
+        }
+        c[i] = r0;
+        c[i + 1] = r1;
+        c[i + 2] = r2;
+        c[i + 3] = r3;
+    }
+    dgemv_rows_scalar(a, b, c, i, ub, n);
+}
+
+// 8 rows x 1 vector: 8 independent FMA chains, tail handled by a mask
+__attribute__((target("avx512f"))) void dgemv_rows_avx512(const double *a, const double *b, double *c, size_t lb, size_t ub, size_t n)
+{
+    size_t i = lb;
+    __mmask8 tail = (__mmask8)((1u << (n % 8)) - 1);
+    for (; i + 8 <= ub; i += 8)
+    {
+        const double *row = a + i * n;
+        __m512d s[8];
+        for (int r = 0; r < 8; r++)
+            s[r] = _mm512_setzero_pd();
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8)
+        {
+            __m512d bj = _mm512_loadu_pd(b + j);
+            for (int r = 0; r < 8; r++)
+                s[r] = _mm512_fmadd_pd(_mm512_loadu_pd(row + r * n + j), bj, s[r]);
+        }
+        if (tail)
+        {
+            __m512d bj = _mm512_maskz_loadu_pd(tail, b + j);
+            for (int r = 0; r < 8; r++)
+                s[r] = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, row + r * n + j), bj, s[r]);
+        }
+        for (int r = 0; r < 8; r++)
+            c[i + r] = _mm512_reduce_add_pd(s[r]);
+    }
+    dgemv_rows_scalar(a, b, c, i, ub, n);
+}
+
+dgemv_rows_func select_dgemv_kernel(const char **name)
 {
-    for (int i = 0; i < m; i++)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
     {
-        c[i] = 0.0;
-        for (int j = 0; j < n; j++)
-            c[i] += a[i * n + j] * b[j];
+        *name = "avx512";
+        return dgemv_rows_avx512;
     }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        *name = "avx2";
+        return dgemv_rows_avx2;
+    }
+    *name = "scalar";
+    return dgemv_rows_scalar;
 }
 
-void matrix_vector_product_omp(double *a, double *b, double *c, int m, int n)
+void matrix_vector_product_simd(double *a, double *b, double *c, size_t m, size_t n, dgemv_rows_func kernel)
 {
 #pragma omp parallel num_threads(NUM_THREADS)
     {
-        int nthreads = omp_get_num_threads();
-        int threadid = omp_get_thread_num();
-        int items_per_thread = m / nthreads;
-        int lb = threadid * items_per_thread;
-        int ub = (threadid == nthreads - 1) ? (m - 1) : (lb + items_per_thread - 1);
-        for (int i = lb; i <= ub; i++)
+        size_t nthreads = omp_get_num_threads();
+        size_t threadid = omp_get_thread_num();
+        // keep the blocks of 8 rows whole inside one thread
+        size_t items_per_thread = m / nthreads / 8 * 8;
+        size_t lb = threadid * items_per_thread;
+        size_t ub = (threadid == nthreads - 1) ? m : (lb + items_per_thread);
+        kernel(a, b, c, lb, ub, n);
+    }
+}
+
+// y[j] = sum_i a[i * len + j] * x[i] for j < len: the matrix is still read
+// row by row. Every thread accumulates its rows into a private partial y,
+// tile by tile, and the partials are summed by a parallel reduction where
+// each thread owns a slice of y.
+void matrix_vector_product_axpy(double *a, double *x, double *y, size_t rows, size_t len)
+{
+    double *partial = (double *)malloc(sizeof(*partial) * NUM_THREADS * len);
+#pragma omp parallel num_threads(NUM_THREADS)
+    {
+        size_t nthreads = omp_get_num_threads();
+        size_t threadid = omp_get_thread_num();
+        size_t items_per_thread = rows / nthreads;
+        size_t lb = threadid * items_per_thread;
+        size_t ub = (threadid == nthreads - 1) ? rows : (lb + items_per_thread);
+        double *py = partial + threadid * len;
+        memset(py, 0, sizeof(*py) * len);
+
+        for (size_t jb = 0; jb < len; jb += TILE_COLS)
         {
-            c[i] = 0.0;
-            for (int j = 0; j < n; j++)
-                c[i] += a[i * n + j] * b[j];
+            size_t je = jb + TILE_COLS < len ? jb + TILE_COLS : len;
+            for (size_t i = lb; i < ub; i++)
+            {
+                double xi = x[i];
+                double *row = a + i * len;
+                for (size_t j = jb; j < je; j++)
+                    py[j] += row[j] * xi;
+            }
+        }
+#pragma omp barrier
+        size_t slice = len / nthreads;
+        size_t jlb = threadid * slice;
+        size_t jub = (threadid == nthreads - 1) ? len : (jlb + slice);
+        for (size_t j = jlb; j < jub; j++)
+        {
+            double sum = 0.0;
+            for (size_t t = 0; t < nthreads; t++)
+                sum += partial[t * len + j];
+            y[j] = sum;
         }
     }
+    free(partial);
+}
+
+// y = A * x or y = A^T * x for an m x n matrix A in either layout. A column
+// major A is the row major A^T, so every case is one of two traversals:
+// dot products along stored rows, or tiled axpy updates along stored rows.
+void gemv(double *a, double *x, double *y, size_t m, size_t n, matrix_layout layout, int transposed)
+{
+    if (layout == ROW_MAJOR && !transposed)
+        matrix_vector_product_omp(a, x, y, m, n);
+    else if (layout == ROW_MAJOR)
+        matrix_vector_product_axpy(a, x, y, m, n);
+    else if (transposed)
+        matrix_vector_product_omp(a, x, y, n, m);
+    else
+        matrix_vector_product_axpy(a, x, y, n, m);
+}
+
+// Reduced-precision matrix storage. Values are expanded to double right
+// after the load and accumulated in double; int8 rows carry a double scale
+// (max |a| / 127) that is applied once to the finished row sum.
+static inline uint16_t to_bf16(double v)
+{
+    float f = (float)v;
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += 0x7fff + ((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+static inline double decode(float v) { return v; }
+static inline double decode(uint16_t v)
+{
+    uint32_t u = (uint32_t)v << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+static inline double decode(int8_t v) { return v; }
+
+void compress_rows(const double *a, float *out, double *, size_t m, size_t n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (size_t i = 0; i < m * n; i++)
+        out[i] = (float)a[i];
+}
+
+void compress_rows(const double *a, uint16_t *out, double *, size_t m, size_t n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (size_t i = 0; i < m * n; i++)
+        out[i] = to_bf16(a[i]);
+}
+
+void compress_rows(const double *a, int8_t *out, double *scale, size_t m, size_t n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (size_t i = 0; i < m; i++)
+    {
+        double max_abs = 0.0;
+        for (size_t j = 0; j < n; j++)
+            max_abs = fmax(max_abs, fabs(a[i * n + j]));
+        scale[i] = max_abs > 0.0 ? max_abs / 127.0 : 1.0;
+        for (size_t j = 0; j < n; j++)
+            out[i * n + j] = (int8_t)lrint(a[i * n + j] / scale[i]);
+    }
+}
+
+template <typename S>
+void dgemv_rows_compressed_scalar(const S *a, const double *scale, const double *b, double *c, size_t lb, size_t ub, size_t n)
+{
+    for (size_t i = lb; i < ub; i++)
+    {
+        double sum = 0.0;
+        for (size_t j = 0; j < n; j++)
+            sum += decode(a[i * n + j]) * b[j];
+        c[i] = scale != NULL ? sum * scale[i] : sum;
+    }
+}
+
+__attribute__((target("avx512f"))) static inline __m512d load8_pd(const float *p)
+{
+    return _mm512_cvtps_pd(_mm256_loadu_ps(p));
+}
+
+__attribute__((target("avx512f"))) static inline __m512d load8_pd(const uint16_t *p)
+{
+    __m256i bits = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p)), 16);
+    return _mm512_cvtps_pd(_mm256_castsi256_ps(bits));
+}
+
+__attribute__((target("avx512f"))) static inline __m512d load8_pd(const int8_t *p)
+{
+    return _mm512_cvtepi32_pd(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+
+// 4 rows per pass, 8 values per row expanded to one zmm of doubles
+template <typename S>
+__attribute__((target("avx512f"))) void dgemv_rows_compressed_avx512(const S *a, const double *scale, const double *b, double *c, size_t lb, size_t ub, size_t n)
+{
+    size_t i = lb;
+    for (; i + 4 <= ub; i += 4)
+    {
+        const S *a0 = a + i * n, *a1 = a0 + n, *a2 = a1 + n, *a3 = a2 + n;
+        __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+        __m512d s2 = _mm512_setzero_pd(), s3 = _mm512_setzero_pd();
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8)
+        {
+            __m512d bj = _mm512_loadu_pd(b + j);
+            s0 = _mm512_fmadd_pd(load8_pd(a0 + j), bj, s0);
+            s1 = _mm512_fmadd_pd(load8_pd(a1 + j), bj, s1);
+            s2 = _mm512_fmadd_pd(load8_pd(a2 + j), bj, s2);
+            s3 = _mm512_fmadd_pd(load8_pd(a3 + j), bj, s3);
+        }
+        double r[4] = {_mm512_reduce_add_pd(s0), _mm512_reduce_add_pd(s1),
+                       _mm512_reduce_add_pd(s2), _mm512_reduce_add_pd(s3)};
+        for (int k = 0; k < 4; k++)
+        {
+            const S *row = a0 + k * n;
+            for (size_t jt = j; jt < n; jt++)
+                r[k] += decode(row[jt]) * b[jt];
+            c[i + k] = scale != NULL ? r[k] * scale[i + k] : r[k];
+        }
+    }
+    dgemv_rows_compressed_scalar(a, scale, b, c, i, ub, n);
+}
+
+template <typename S>
+void matrix_vector_product_compressed(const S *a, const double *scale, double *b, double *c, size_t m, size_t n)
+{
+    int avx512 = __builtin_cpu_supports("avx512f");
+#pragma omp parallel num_threads(NUM_THREADS)
+    {
+        size_t nthreads = omp_get_num_threads();
+        size_t threadid = omp_get_thread_num();
+        size_t items_per_thread = m / nthreads / 4 * 4;
+        size_t lb = threadid * items_per_thread;
+        size_t ub = (threadid == nthreads - 1) ? m : (lb + items_per_thread);
+        if (avx512)
+            dgemv_rows_compressed_avx512(a, scale, b, c, lb, ub, n);
+        else
+            dgemv_rows_compressed_scalar(a, scale, b, c, lb, ub, n);
+    }
 }
 
 void run_serial(size_t n, size_t m)
@@ -57,13 +377,13 @@ void run_serial(size_t n, size_t m)
         exit(1);
     }
 
-    for (int i = 0; i < m; i++)
+    for (size_t i = 0; i < m; i++)
     {
-        for (int j = 0; j < n; j++)
+        for (size_t j = 0; j < n; j++)
             a[i * n + j] = i + j;
     }
 
-    for (int j = 0; j < n; j++)
+    for (size_t j = 0; j < n; j++)
         b[j] = j;
 
     double t = cpuSecond();
@@ -80,14 +400,14 @@ void fill_mat(double* arr, size_t m, size_t n){
 
     #pragma omp parallel num_threads(NUM_THREADS)
     {
-        int nthreads = omp_get_num_threads();
-        int threadid = omp_get_thread_num();
-        int items_per_thread = m / nthreads;
-        int lb = threadid * items_per_thread;
-        int ub = (threadid == nthreads - 1) ? (m - 1) : (lb + items_per_thread - 1);
-        for (int i = lb; i <= ub; i++)
+        size_t nthreads = omp_get_num_threads();
+        size_t threadid = omp_get_thread_num();
+        size_t items_per_thread = m / nthreads;
+        size_t lb = threadid * items_per_thread;
+        size_t ub = (threadid == nthreads - 1) ? m : (lb + items_per_thread);
+        for (size_t i = lb; i < ub; i++)
         {
-            for (int j = 0; j < n; j++)
+            for (size_t j = 0; j < n; j++)
                 arr[i * n + j] = i + j;
         }
     }
@@ -112,7 +432,7 @@ double* run_parallel(size_t n, size_t m)
 
     fill_mat(a, m, n);
 
-    for (int j = 0; j < n; j++)
+    for (size_t j = 0; j < n; j++)
         b[j] = j;
     
 
@@ -127,18 +447,474 @@ double* run_parallel(size_t n, size_t m)
     return c;
 }
 
+// Times the plain OpenMP kernel against the register-blocked one on the same
+// data and reports GFLOP/s for both (2 * m * n flops per product).
+void run_simd(size_t n, size_t m)
+{
+    double *a, *b, *c, *c_simd;
+
+    a = (double*)malloc(sizeof(*a) * m * n);
+    b = (double*)malloc(sizeof(*b) * n);
+    c = (double*)malloc(sizeof(*c) * m);
+    c_simd = (double*)malloc(sizeof(*c_simd) * m);
+
+    if (a == NULL || b == NULL || c == NULL || c_simd == NULL)
+    {
+        free(a);
+        free(b);
+        free(c);
+        free(c_simd);
+        printf("Error allocate memory!\n");
+        exit(1);
+    }
+
+    fill_mat(a, m, n);
+
+    for (size_t j = 0; j < n; j++)
+        b[j] = j;
+
+    const char *name;
+    dgemv_rows_func kernel = select_dgemv_kernel(&name);
+    double flops = 2.0 * m * n;
+
+    double t = cpuSecond();
+    matrix_vector_product_omp(a, b, c, m, n);
+    t = cpuSecond() - t;
+    printf("Elapsed time (parallel): %.6f sec. %.3f GFLOP/s\n", t, flops / t * 1e-9);
+
+    double t_simd = cpuSecond();
+    matrix_vector_product_simd(a, b, c_simd, m, n, kernel);
+    t_simd = cpuSecond() - t_simd;
+    printf("Elapsed time (%s): %.6f sec. %.3f GFLOP/s\n", name, t_simd, flops / t_simd * 1e-9);
+
+    double max_err = 0.0;
+    for (size_t i = 0; i < m; i++)
+    {
+        double err = fabs(c_simd[i] - c[i]) / fabs(c[i] != 0.0 ? c[i] : 1.0);
+        if (err > max_err)
+            max_err = err;
+    }
+    printf("Speedup: %.3f, max relative difference: %e\n", t / t_simd, max_err);
+
+    free(a);
+    free(b);
+    free(c);
+    free(c_simd);
+}
+
+// Runs all four layout / transpose combinations on an m x n matrix and
+// reports time and achieved matrix bandwidth, checked against a serial
+// reference. The matrix is not symmetric, so a wrong traversal shows up.
+void run_transposed(size_t n, size_t m)
+{
+    double *a_row = (double *)malloc(sizeof(double) * m * n);
+    double *a_col = (double *)malloc(sizeof(double) * m * n);
+    size_t len = m > n ? m : n;
+    double *x = (double *)malloc(sizeof(double) * len);
+    double *y = (double *)malloc(sizeof(double) * len);
+    double *ref = (double *)malloc(sizeof(double) * len);
+
+    if (a_row == NULL || a_col == NULL || x == NULL || y == NULL || ref == NULL)
+    {
+        free(a_row);
+        free(a_col);
+        free(x);
+        free(y);
+        free(ref);
+        printf("Error allocate memory!\n");
+        exit(1);
+    }
+
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (size_t i = 0; i < m; i++)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            a_row[i * n + j] = (double)((i + 3 * j) % 17);
+            a_col[j * m + i] = (double)((i + 3 * j) % 17);
+        }
+    }
+    for (size_t k = 0; k < len; k++)
+        x[k] = (double)(k % 5);
+
+    const char *names[2] = {"row", "col"};
+    for (int layout = ROW_MAJOR; layout <= COL_MAJOR; layout++)
+    {
+        for (int transposed = 0; transposed <= 1; transposed++)
+        {
+            size_t out = transposed ? n : m;
+            for (size_t k = 0; k < out; k++)
+            {
+                double sum = 0.0;
+                for (size_t l = 0; l < (transposed ? m : n); l++)
+                    sum += (transposed ? a_row[l * n + k] : a_row[k * n + l]) * x[l];
+                ref[k] = sum;
+            }
+
+            double *a = layout == ROW_MAJOR ? a_row : a_col;
+            double t = cpuSecond();
+            gemv(a, x, y, m, n, (matrix_layout)layout, transposed);
+            t = cpuSecond() - t;
+
+            double max_err = 0.0;
+            for (size_t k = 0; k < out; k++)
+                max_err = fmax(max_err, fabs(y[k] - ref[k]));
+
+            printf("Elapsed time (%s-major, %s): %.6f sec. %.3f GB/s, max error %e\n", names[layout],
+                   transposed ? "A^T*x" : "A*x", t, sizeof(double) * m * n / t * 1e-9, max_err);
+        }
+    }
+
+    free(a_row);
+    free(a_col);
+    free(x);
+    free(y);
+    free(ref);
+}
+
+// Parses a sysfs cpu list such as "0-19,40-59".
+void parse_cpulist(const char *list, numa_node *node)
+{
+    node->ncpus = 0;
+    while (*list != '\0' && *list != '\n')
+    {
+        char *end;
+        long first = strtol(list, &end, 10);
+        long last = first;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && node->ncpus < MAX_CPUS; cpu++)
+            node->cpus[node->ncpus++] = (int)cpu;
+        list = (*end == ',') ? end + 1 : end;
+    }
+}
+
+// Reads the NUMA nodes from sysfs. Without sysfs everything is one node.
+int detect_numa_nodes(numa_node *nodes)
+{
+    int nnodes = 0;
+    for (int id = 0; id < MAX_NODES; id++)
+    {
+        char path[64], list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+            continue;
+        if (fgets(list, sizeof(list), f) != NULL)
+        {
+            parse_cpulist(list, &nodes[nnodes]);
+            if (nodes[nnodes].ncpus > 0)
+                nnodes++;
+        }
+        fclose(f);
+    }
+    if (nnodes == 0)
+    {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nodes[0].ncpus = 0;
+        for (long cpu = 0; cpu < ncpus && cpu < MAX_CPUS; cpu++)
+            nodes[0].cpus[nodes[0].ncpus++] = (int)cpu;
+        nnodes = 1;
+    }
+    return nnodes;
+}
+
+// Topology-aware product: rows are split between NUMA nodes, then between
+// the threads of a node, each thread pinned to one cpu of its node. The
+// matrix rows, c and a per-node copy of b are first touched by the threads
+// that later read them, so all traffic of the product stays node-local.
+void run_numa(size_t n, size_t m)
+{
+    static numa_node nodes[MAX_NODES];
+    int nnodes = detect_numa_nodes(nodes);
+    int nthreads_total = NUM_THREADS < nnodes ? nnodes : NUM_THREADS;
+
+    double *a = (double *)malloc(sizeof(*a) * m * n);
+    double *c = (double *)malloc(sizeof(*c) * m);
+    double *b_node[MAX_NODES] = {NULL};
+    double node_start[MAX_NODES] = {0}, node_end[MAX_NODES] = {0}, node_time[MAX_NODES] = {0};
+    size_t node_rows[MAX_NODES] = {0};
+    int active_nodes = nnodes;
+    int granted_threads = nthreads_total;
+
+    if (a == NULL || c == NULL)
+    {
+        free(a);
+        free(c);
+        printf("Error allocate memory!\n");
+        exit(1);
+    }
+
+    const char *name;
+    dgemv_rows_func kernel = select_dgemv_kernel(&name);
+
+#pragma omp parallel num_threads(nthreads_total)
+    {
+        int nthreads = omp_get_num_threads();
+        int threadid = omp_get_thread_num();
+        // OpenMP may grant fewer threads than asked for; without one per
+        // node some nodes would have no thread, run everything on node 0
+        int nnodes_used = nthreads >= nnodes ? nnodes : 1;
+        if (threadid == 0)
+        {
+            active_nodes = nnodes_used;
+            granted_threads = nthreads;
+        }
+        int node = (int)((long)threadid * nnodes_used / nthreads);
+        int first_thread = (int)(((long)node * nthreads + nnodes_used - 1) / nnodes_used);
+        int last_thread = (int)(((long)(node + 1) * nthreads + nnodes_used - 1) / nnodes_used);
+        int local_id = threadid - first_thread;
+        int local_threads = last_thread - first_thread;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(nodes[node].cpus[local_id % nodes[node].ncpus], &set);
+        sched_setaffinity(0, sizeof(set), &set);
+
+        size_t node_lb = m * node / nnodes_used;
+        size_t node_ub = m * (node + 1) / nnodes_used;
+        size_t items_per_thread = (node_ub - node_lb) / local_threads;
+        size_t lb = node_lb + local_id * items_per_thread;
+        size_t ub = (local_id == local_threads - 1) ? node_ub : (lb + items_per_thread);
+
+        if (local_id == 0)
+        {
+            node_rows[node] = node_ub - node_lb;
+            b_node[node] = (double *)malloc(sizeof(double) * n);
+            for (size_t j = 0; j < n; j++)
+                b_node[node][j] = j;
+        }
+        for (size_t i = lb; i < ub; i++)
+        {
+            c[i] = 0.0;
+            for (size_t j = 0; j < n; j++)
+                a[i * n + j] = i + j;
+        }
+#pragma omp barrier
+
+        double start = omp_get_wtime();
+        kernel(a, b_node[node], c, lb, ub, n);
+        double end = omp_get_wtime();
+
+        // node time runs from its first thread starting to its last finishing
+        if (local_id == 0)
+        {
+            node_start[node] = start;
+            node_end[node] = end;
+        }
+#pragma omp barrier
+#pragma omp critical
+        {
+            node_start[node] = fmin(node_start[node], start);
+            node_end[node] = fmax(node_end[node], end);
+        }
+#pragma omp barrier
+        if (local_id == 0)
+            node_time[node] = node_end[node] - node_start[node];
+    }
+
+    double first = node_start[0], last = node_end[0];
+    if (active_nodes < nnodes)
+        printf("Only %d threads for %d nodes, ran on node 0 alone\n", granted_threads, nnodes);
+    for (int k = 1; k < active_nodes; k++)
+    {
+        first = fmin(first, node_start[k]);
+        last = fmax(last, node_end[k]);
+    }
+    double total = last - first;
+    printf("Elapsed time (numa, %s, %d nodes, %d threads): %.6f sec. %.3f GB/s\n", name, active_nodes,
+           granted_threads, total, sizeof(double) * m * n / total * 1e-9);
+    for (int k = 0; k < active_nodes; k++)
+    {
+        printf("  node %d: %zu rows, %.6f sec. %.3f GB/s\n", k, node_rows[k], node_time[k],
+               sizeof(double) * node_rows[k] * n / node_time[k] * 1e-9);
+        free(b_node[k]);
+    }
+
+    free(a);
+    free(c);
+}
+
+template <typename S>
+void run_compressed_format(const char *name, double *a, double *b, double *ref, double t_ref, size_t m, size_t n)
+{
+    S *a_small = (S *)malloc(sizeof(S) * m * n);
+    double *scale = sizeof(S) == 1 ? (double *)malloc(sizeof(double) * m) : NULL;
+    double *c = (double *)malloc(sizeof(double) * m);
+    if (a_small == NULL || c == NULL)
+    {
+        free(a_small);
+        free(scale);
+        free(c);
+        printf("Error allocate memory!\n");
+        exit(1);
+    }
+    compress_rows(a, a_small, scale, m, n);
+
+    // warm-up, as for the fp64 run
+    matrix_vector_product_compressed(a_small, scale, b, c, m, n);
+    double t = cpuSecond();
+    matrix_vector_product_compressed(a_small, scale, b, c, m, n);
+    t = cpuSecond() - t;
+
+    double max_err = 0.0;
+    for (size_t i = 0; i < m; i++)
+        max_err = fmax(max_err, fabs(c[i] - ref[i]) / fmax(fabs(ref[i]), 1e-300));
+
+    printf("Elapsed time (%s): %.6f sec. %.3f GB/s, speedup %.3f, max relative error %e\n", name, t,
+           (sizeof(S) * m * n + (scale ? sizeof(double) * m : 0)) / t * 1e-9, t_ref / t, max_err);
+
+    free(a_small);
+    free(scale);
+    free(c);
+}
+
+// Runs the double product, then the same product from fp32, bf16 or
+// per-row scaled int8 storage, and reports speedup and max relative error.
+// The fp64 time comes from the register-blocked SIMD kernel, the same
+// family as the compressed kernels, so the speedup is that of the smaller
+// storage alone. Every run is timed after a warm-up call.
+void run_compressed(size_t n, size_t m, const char *format)
+{
+    double *a = (double *)malloc(sizeof(*a) * m * n);
+    double *b = (double *)malloc(sizeof(*b) * n);
+    double *ref = (double *)malloc(sizeof(*ref) * m);
+    if (a == NULL || b == NULL || ref == NULL)
+    {
+        free(a);
+        free(b);
+        free(ref);
+        printf("Error allocate memory!\n");
+        exit(1);
+    }
+
+    fill_mat(a, m, n);
+    for (size_t j = 0; j < n; j++)
+        b[j] = j;
+
+    // the plain loop gives the reference result and warms up the matrix
+    matrix_vector_product_omp(a, b, ref, m, n);
+
+    const char *name;
+    dgemv_rows_func kernel = select_dgemv_kernel(&name);
+    double *c = (double *)malloc(sizeof(*c) * m);
+    matrix_vector_product_simd(a, b, c, m, n, kernel);
+    double t = cpuSecond();
+    matrix_vector_product_simd(a, b, c, m, n, kernel);
+    t = cpuSecond() - t;
+    free(c);
+    printf("Elapsed time (fp64, %s): %.6f sec. %.3f GB/s\n", name, t, sizeof(double) * m * n / t * 1e-9);
+
+    int all = strcmp(format, "all") == 0;
+    if (all || strcmp(format, "fp32") == 0)
+        run_compressed_format<float>("fp32", a, b, ref, t, m, n);
+    if (all || strcmp(format, "bf16") == 0)
+        run_compressed_format<uint16_t>("bf16", a, b, ref, t, m, n);
+    if (all || strcmp(format, "int8") == 0)
+        run_compressed_format<int8_t>("int8", a, b, ref, t, m, n);
+
+    free(a);
+    free(b);
+    free(ref);
+}
+
+// Same product with the matrix kept in a file (see matrix_file.hpp). The
+// file is generated on the first run and reused afterwards. "stream" reads
+// row panels with read-ahead, "mmap" leaves the paging to the kernel.
+double *run_file(size_t n, size_t m, const char *path, const char *mode)
+{
+    double t = cpuSecond();
+    int created = prepare_matrix_file(path, "dgemv", m, n, fill_mat);
+    if (created < 0)
+        exit(1);
+    t = cpuSecond() - t;
+    printf("Matrix file %s: %s in %.6f sec.\n", path, created ? "generated" : "cached", t);
+
+    double *b = (double *)malloc(sizeof(*b) * n);
+    double *c = (double *)malloc(sizeof(*c) * m);
+    if (b == NULL || c == NULL)
+    {
+        free(b);
+        free(c);
+        printf("Error allocate memory!\n");
+        exit(1);
+    }
+    for (size_t j = 0; j < n; j++)
+        b[j] = j;
+
+    int ok = 1;
+    t = cpuSecond();
+    if (strcmp(mode, "mmap") == 0)
+    {
+        double *a = map_matrix_file(path, m, n);
+        if (a == NULL)
+            exit(1);
+        matrix_vector_product_omp(a, b, c, m, n);
+        unmap_matrix_file(a, m, n);
+    }
+    else
+    {
+        ok = stream_matrix_file(path, m, n, [&](double *panel, size_t first, size_t rows)
+                                { matrix_vector_product_omp(panel, b, c + first, rows, n); });
+    }
+    t = cpuSecond() - t;
+
+    if (!ok)
+    {
+        printf("Error reading %s!\n", path);
+        exit(1);
+    }
+    printf("Elapsed time (%s): %.6f sec.\n", mode, t);
+    free(b);
+    return c;
+}
+
+// usage: dgemv.exe [M] [matrix file] [stream|mmap]
+//        dgemv.exe [M] simd
+//        dgemv.exe [M] trans
+//        dgemv.exe [M] numa
+//        dgemv.exe [M] compressed [fp32|bf16|int8|all]
 int main(int argc, char *argv[])
 {
     size_t M = MATRIX_SIZE;
     size_t N = MATRIX_SIZE;
 
     if (argc > 1)
-        M = atoi(argv[1]);
+        M = atol(argv[1]);
     N = M;
     // printf("%d", M);
-    double* c = run_parallel(M, N);
+    if (argc > 2 && strcmp(argv[2], "simd") == 0)
+    {
+        run_simd(M, N);
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "trans") == 0)
+    {
+        run_transposed(M, N);
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "numa") == 0)
+    {
+        run_numa(M, N);
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "compressed") == 0)
+    {
+        run_compressed(M, N, argc > 3 ? argv[3] : "all");
+        return 0;
+    }
+
+    double* c;
+    if (argc > 2)
+        c = run_file(M, N, argv[2], argc > 3 ? argv[3] : "stream");
+    else
+        c = run_parallel(M, N);
     // for (int i = 0; i < M; i++){
     //     printf("%f ", c[i]);
     // }
+    free(c);
     return 0;
 }
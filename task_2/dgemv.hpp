@@ -0,0 +1,40 @@
+#pragma once
+
+// Reference DGEMV kernels, shared by dgemv.cpp and benchmark.cpp. Programs
+// that fix the team size define NUM_THREADS before including this header,
+// otherwise the OpenMP default applies.
+
+#include <stddef.h>
+#include <omp.h>
+
+#ifndef NUM_THREADS
+#define NUM_THREADS omp_get_max_threads()
+#endif
+
+inline void matrix_vector_product(double *a, double *b, double *c, size_t m, size_t n)
+{
+    for (size_t i = 0; i < m; i++)
+    {
+        c[i] = 0.0;
+        for (size_t j = 0; j < n; j++)
+            c[i] += a[i * n + j] * b[j];
+    }
+}
+
+inline void matrix_vector_product_omp(double *a, double *b, double *c, size_t m, size_t n)
+{
+#pragma omp parallel num_threads(NUM_THREADS)
+    {
+        size_t nthreads = omp_get_num_threads();
+        size_t threadid = omp_get_thread_num();
+        size_t items_per_thread = m / nthreads;
+        size_t lb = threadid * items_per_thread;
+        size_t ub = (threadid == nthreads - 1) ? m : (lb + items_per_thread);
+        for (size_t i = lb; i < ub; i++)
+        {
+            c[i] = 0.0;
+            for (size_t j = 0; j < n; j++)
+                c[i] += a[i * n + j] * b[j];
+        }
+    }
+}
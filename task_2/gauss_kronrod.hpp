@@ -0,0 +1,232 @@
+#pragma once
+
+// Adaptive Gauss-Kronrod (G7-K15) integrator.
+//
+// Every thread keeps a max-heap of intervals ordered by error estimate. A
+// thread bisects the largest interval it can find: its own top, or the top
+// of the next victim if that one is larger, so the intervals with the worst
+// error are refined first whichever thread created them. The loop stops when
+// the summed error estimate meets the tolerance.
+//
+// The first grid has GK_START_INTERVALS intervals whatever the thread count,
+// dealt round robin; threads that get none steal from the start. The work
+// then follows the integrand, only the last few bisections before the
+// tolerance is met can differ between thread counts.
+
+#include <math.h>
+#include <omp.h>
+#include <mutex>
+#include <queue>
+#include <vector>
+#include "integration.hpp"
+
+// abscissae of the 15-point Kronrod rule, the odd ones are the 7-point Gauss nodes
+static const double xgk[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.000000000000000000000000000000000};
+
+static const double wgk[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714};
+
+static const double wg[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327};
+
+#define GK_POINTS 15
+#define GK_START_INTERVALS 4
+
+struct gk_interval
+{
+    double a, b;
+    double value, error;
+
+    bool operator<(const gk_interval &other) const { return error < other.error; }
+};
+
+struct adaptive_result
+{
+    double value;
+    double error;
+    long evaluations;
+    long intervals;
+    int converged;
+};
+
+// K15 on [a, b] with the QUADPACK error estimate, which scales |K15 - G7|
+// down when the rule is clearly resolving the integrand.
+template <typename Func>
+gk_interval gk15(const Func &func, double a, double b)
+{
+    double center = 0.5 * (a + b);
+    double half = 0.5 * (b - a);
+
+    double x[GK_POINTS], y[GK_POINTS];
+    for (int k = 0; k < 7; k++)
+    {
+        x[2 * k] = center - half * xgk[k];
+        x[2 * k + 1] = center + half * xgk[k];
+    }
+    x[14] = center;
+    if constexpr (has_batch_eval<Func>::value)
+        func.eval(x, y, GK_POINTS);
+    else
+        for (int k = 0; k < GK_POINTS; k++)
+            y[k] = func(x[k]);
+
+    double fc = y[14];
+    double kronrod = fc * wgk[7];
+    double gauss = fc * wg[3];
+    for (int k = 0; k < 7; k++)
+    {
+        double pair = y[2 * k] + y[2 * k + 1];
+        kronrod += wgk[k] * pair;
+        if (k % 2 == 1)
+            gauss += wg[k / 2] * pair;
+    }
+
+    double mean = 0.5 * kronrod;
+    double asc = wgk[7] * fabs(fc - mean);
+    for (int k = 0; k < 7; k++)
+        asc += wgk[k] * (fabs(y[2 * k] - mean) + fabs(y[2 * k + 1] - mean));
+
+    double error = fabs((kronrod - gauss) * half);
+    asc *= fabs(half);
+    if (asc != 0.0 && error != 0.0)
+        error = asc * fmin(1.0, pow(200.0 * error / asc, 1.5));
+
+    gk_interval r = {a, b, kronrod * half, error};
+    return r;
+}
+
+struct interval_heap
+{
+    std::mutex mut;
+    std::priority_queue<gk_interval> heap;
+};
+
+// Takes the larger of the local top and the victim's top. Returns 0 when
+// both heaps are empty.
+inline int take_interval(interval_heap &own, interval_heap &victim, gk_interval &out)
+{
+    interval_heap *from = &own;
+    if (&victim != &own)
+    {
+        // lock in address order, two threads may pick each other
+        interval_heap *first = &own < &victim ? &own : &victim;
+        interval_heap *second = &own < &victim ? &victim : &own;
+        std::lock_guard<std::mutex> l1(first->mut);
+        std::lock_guard<std::mutex> l2(second->mut);
+        if (own.heap.empty() || (!victim.heap.empty() && victim.heap.top().error > own.heap.top().error))
+            from = &victim;
+        if (from->heap.empty())
+            return 0;
+        out = from->heap.top();
+        from->heap.pop();
+        return 1;
+    }
+    std::lock_guard<std::mutex> lock(own.mut);
+    if (own.heap.empty())
+        return 0;
+    out = own.heap.top();
+    own.heap.pop();
+    return 1;
+}
+
+// Integrates func over [a, b] until the summed error estimate is below
+// max(abs_tol, rel_tol * |value|) or max_intervals subintervals exist.
+template <typename Func>
+adaptive_result integrate_adaptive(const Func &func, double a, double b, double abs_tol, double rel_tol,
+                                   long max_intervals, size_t num_threads)
+{
+    std::vector<interval_heap> heaps(num_threads);
+    double total_value = 0.0, total_error = 0.0;
+    long intervals = 0, evaluations = 0;
+    int stop = 0;
+
+#pragma omp parallel num_threads(num_threads)
+    {
+        int nthreads = omp_get_num_threads();
+        int id = omp_get_thread_num();
+        interval_heap &own = heaps[id];
+
+        double width = (b - a) / GK_START_INTERVALS;
+        double value = 0.0, error = 0.0;
+        long rules = 0;
+        for (int i = id; i < GK_START_INTERVALS; i += nthreads, rules++)
+        {
+            gk_interval r = gk15(func, a + width * i, i == GK_START_INTERVALS - 1 ? b : a + width * (i + 1));
+            own.heap.push(r);
+            value += r.value;
+            error += r.error;
+        }
+#pragma omp atomic
+        total_value += value;
+#pragma omp atomic
+        total_error += error;
+#pragma omp atomic
+        intervals += rules;
+#pragma omp barrier
+
+        for (int victim = (id + 1) % nthreads;; victim = (victim + 1) % nthreads)
+        {
+            double cur_value, cur_error;
+            long cur_intervals;
+            int cur_stop;
+#pragma omp atomic read
+            cur_value = total_value;
+#pragma omp atomic read
+            cur_error = total_error;
+#pragma omp atomic read
+            cur_intervals = intervals;
+#pragma omp atomic read
+            cur_stop = stop;
+            if (cur_stop || cur_error <= fmax(abs_tol, rel_tol * fabs(cur_value)) || cur_intervals >= max_intervals)
+            {
+#pragma omp atomic write
+                stop = 1;
+                break;
+            }
+
+            gk_interval parent;
+            if (!take_interval(own, heaps[victim], parent))
+                continue;
+
+            double mid = 0.5 * (parent.a + parent.b);
+            gk_interval left = gk15(func, parent.a, mid);
+            gk_interval right = gk15(func, mid, parent.b);
+            {
+                std::lock_guard<std::mutex> lock(own.mut);
+                own.heap.push(left);
+                own.heap.push(right);
+            }
+            rules += 2;
+#pragma omp atomic
+            total_value += left.value + right.value - parent.value;
+#pragma omp atomic
+            total_error += left.error + right.error - parent.error;
+#pragma omp atomic
+            intervals += 1;
+        }
+#pragma omp atomic
+        evaluations += rules * GK_POINTS;
+    }
+
+    // the running totals drift by rounding, the leaves give the exact sums
+    adaptive_result res = {0.0, 0.0, evaluations, 0, 0};
+    for (auto &h : heaps)
+    {
+        for (; !h.heap.empty(); h.heap.pop())
+        {
+            res.value += h.heap.top().value;
+            res.error += h.heap.top().error;
+            res.intervals++;
+        }
+    }
+    res.converged = res.error <= fmax(abs_tol, rel_tol * fabs(res.value));
+    return res;
+}
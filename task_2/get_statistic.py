@@ -1,13 +1,14 @@
 import subprocess
 
-def get_stat_sle(path:str, exe:str):
+def get_stat_sle(path:str, exe:str, schedule:str):
+    subprocess.run(["g++", exe, "-D NUM_THREADS=40", "-o", "out.exe", "-fopenmp"])
     with open(path, "w") as file:
         for i in range(1, 70 * 100, 100):
-            subprocess.run(["g++", exe, "-D NUM_THREADS=40", f"-D CHUNCK_SIZE={i}", "-D TYPE=guided", "-o", "out.exe", "-fopenmp"])
-            out = subprocess.run(["./out.exe"], stdout=subprocess.PIPE)
+            # the matrix is generated on the first run and mapped from the file after that
+            out = subprocess.run(["./out.exe", "20000", "0.0000025", "0.00001", schedule, str(i), "sle_matrix.bin"],
+                                 stdout=subprocess.PIPE)
             file.write(str(float(out.stdout)) + ' ')
             print(out.stdout)
 
 
-get_stat_sle("data/static1.txt", "SLE3.cpp")
-
+get_stat_sle("data/static1.txt", "SLE3.cpp", "guided")
@@ -3,6 +3,9 @@
 #include <time.h>
 #include <omp.h>
 #include <cmath>
+#include <vector>
+#include "integration.hpp"
+#include "gauss_kronrod.hpp"
 
 #define N_STEPS 40000000
 #define NUM_THREADS 8
@@ -10,11 +13,29 @@
 #define A -4.0
 #define B 4.0
 
+#define ABS_TOL 1e-12
+#define REL_TOL 1e-12
+#define MAX_INTERVALS 1000000
+
+// batch demo: many small integrals of exp(-s * x^2) plus a few large ones
+#define BATCH_INTEGRALS 20000
+#define BATCH_STEPS 1000
+#define BATCH_LARGE_EVERY 1000
+#define BATCH_LARGE_STEPS 1000000
+
 double func(double x)
 {
     return exp(-x * x);
 }
 
+struct gauss_scaled
+{
+    double operator()(double s, double x) const
+    {
+        return simd_exp(-s * x * x);
+    }
+};
+
 double cpuSecond()
 {
     struct timespec ts;
@@ -22,31 +43,19 @@ double cpuSecond()
     return ((double)ts.tv_sec + (double)ts.tv_nsec * 1.e-9);
 }
 
-double integrate_omp(double (*func)(double), double a, double b, int n, size_t num_threads)
-{
-    double h = (b - a) / n;
-    double sum = 0.0;
-#pragma omp parallel num_threads(num_threads)
-    {
-        int nthreads = omp_get_num_threads();
-        int threadid = omp_get_thread_num();
-        int items_per_thread = n / nthreads;
-        int lb = threadid * items_per_thread;
-        int ub = (threadid == nthreads - 1) ? (n - 1) : (lb + items_per_thread - 1);
-        double sumloc = 0.0;
-        for (int i = lb; i <= ub; i++)
-            sumloc += func(a + h * (i + 0.5));
-#pragma omp atomic
-        sum += sumloc;
-    }
-    sum *= h;
-    return sum;
-}
-
+// usage: integration.exe [abs tol] [rel tol]
 int main(int argc, char *argv[])
 {
     size_t num_threads = NUM_THREADS;
 
+    double abs_tol = ABS_TOL;
+    if (argc > 1)
+        abs_tol = atof(argv[1]);
+
+    double rel_tol = REL_TOL;
+    if (argc > 2)
+        rel_tol = atof(argv[2]);
+
 
     double t = cpuSecond();
     double sum = integrate_omp(func, A, B, N_STEPS, num_threads);
@@ -54,5 +63,59 @@ int main(int argc, char *argv[])
 
     printf("Elapsed time (parallel): %f %.6f sec.\n", sum, t);
 
+    double t_simd = cpuSecond();
+    double sum_simd = integrate(gauss_integrand(), A, B, N_STEPS, num_threads);
+    t_simd = cpuSecond() - t_simd;
+
+    printf("Elapsed time (template, simd exp): %f %.6f sec. speedup %.3f, difference %e\n", sum_simd, t_simd,
+           t / t_simd, fabs(sum_simd - sum));
+
+    double t_adaptive = cpuSecond();
+    adaptive_result res = integrate_adaptive(gauss_integrand(), A, B, abs_tol, rel_tol, MAX_INTERVALS, num_threads);
+    t_adaptive = cpuSecond() - t_adaptive;
+
+    // exp(-x^2) integrates to sqrt(pi) * erf(4) over [-4, 4]
+    double exact = sqrt(M_PI) * erf(4.0);
+    printf("Elapsed time (adaptive G7-K15): %.15f %.6f sec.%s\n", res.value, t_adaptive,
+           res.converged ? "" : " (not converged)");
+    printf("Error estimate %e, actual error %e (fixed step %e)\n", res.error, fabs(res.value - exact),
+           fabs(sum - exact));
+    // with several threads the last bisections race the stop check, the
+    // count of a single-threaded run is what the rule itself needs
+    adaptive_result serial = integrate_adaptive(gauss_integrand(), A, B, abs_tol, rel_tol, MAX_INTERVALS, 1);
+    printf("Evaluations: %ld in %ld intervals (1 thread, %ld with %zu) vs %d fixed step (%.0fx fewer)\n",
+           serial.evaluations, serial.intervals, res.evaluations, num_threads, N_STEPS,
+           (double)N_STEPS / serial.evaluations);
+
+    std::vector<integral_task<double>> tasks(BATCH_INTEGRALS);
+    for (int i = 0; i < BATCH_INTEGRALS; i++)
+    {
+        tasks[i].params = 0.5 + (i % 100) * 0.01;
+        tasks[i].a = -1.0 - (i % 7) * 0.5;
+        tasks[i].b = 1.0 + (i % 5) * 0.5;
+        tasks[i].n = i % BATCH_LARGE_EVERY == 0 ? BATCH_LARGE_STEPS : BATCH_STEPS;
+    }
+    std::vector<double> batch(BATCH_INTEGRALS), single(BATCH_INTEGRALS);
+
+    double t_single = cpuSecond();
+    for (int i = 0; i < BATCH_INTEGRALS; i++)
+    {
+        double s = tasks[i].params;
+        single[i] = integrate([s](double x) { return simd_exp(-s * x * x); }, tasks[i].a, tasks[i].b, tasks[i].n,
+                              num_threads);
+    }
+    t_single = cpuSecond() - t_single;
+
+    double t_batch = cpuSecond();
+    integrate_batch(gauss_scaled(), tasks.data(), tasks.size(), batch.data(), num_threads);
+    t_batch = cpuSecond() - t_batch;
+
+    double max_diff = 0.0;
+    for (int i = 0; i < BATCH_INTEGRALS; i++)
+        max_diff = fmax(max_diff, fabs(batch[i] - single[i]));
+    printf("Elapsed time (one call per integral): %.6f sec. %.0f integrals/s\n", t_single, BATCH_INTEGRALS / t_single);
+    printf("Elapsed time (batch): %.6f sec. %.0f integrals/s, speedup %.3f, max difference %e\n", t_batch,
+           BATCH_INTEGRALS / t_batch, t_single / t_batch, max_diff);
+
     return 0;
 }
\ No newline at end of file
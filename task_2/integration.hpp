@@ -0,0 +1,200 @@
+#pragma once
+
+// Midpoint-rule integrator, shared by integration.cpp and benchmark.cpp.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <omp.h>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <vector>
+
+inline double integrate_omp(double (*func)(double), double a, double b, int n, size_t num_threads)
+{
+    double h = (b - a) / n;
+    double sum = 0.0;
+#pragma omp parallel num_threads(num_threads)
+    {
+        int nthreads = omp_get_num_threads();
+        int threadid = omp_get_thread_num();
+        int items_per_thread = n / nthreads;
+        int lb = threadid * items_per_thread;
+        int ub = (threadid == nthreads - 1) ? (n - 1) : (lb + items_per_thread - 1);
+        double sumloc = 0.0;
+        for (int i = lb; i <= ub; i++)
+            sumloc += func(a + h * (i + 0.5));
+#pragma omp atomic
+        sum += sumloc;
+    }
+    sum *= h;
+    return sum;
+}
+
+// exp that the compiler can vectorize: 2^k * e^r with k = round(x / ln2)
+// and a degree-12 Taylor polynomial for |r| <= ln2 / 2 (relative error
+// ~2e-16). 2^k is assembled in the exponent bits, which only works for
+// -708 <= x <= 709; there is no range check, since a clamp would keep the
+// loop from vectorizing without -ffast-math.
+#define EXP_SHIFT 0x1.8p52
+
+inline double simd_exp(double x)
+{
+    double kd = x * 1.4426950408889634 + EXP_SHIFT;
+    uint64_t bits;
+    memcpy(&bits, &kd, sizeof(bits));
+    kd -= EXP_SHIFT;
+    double r = x - kd * 6.93147180369123816490e-01 - kd * 1.90821492927058770002e-10;
+
+    double p = 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+
+    uint64_t scale_bits = (bits + 1023) << 52;
+    double scale;
+    memcpy(&scale, &scale_bits, sizeof(scale));
+    return p * scale;
+}
+
+// exp(-x * x) with the batch hook used by integrate(), for |x| <= 26
+struct gauss_integrand
+{
+    double operator()(double x) const
+    {
+        return simd_exp(-x * x);
+    }
+
+    void eval(const double *x, double *y, size_t count) const
+    {
+#pragma omp simd
+        for (size_t k = 0; k < count; k++)
+            y[k] = simd_exp(-x[k] * x[k]);
+    }
+};
+
+// An integrand may provide eval(x, y, count) to compute a whole block of
+// points at once; otherwise operator() is called from a simd loop, which
+// vectorizes when it inlines.
+template <typename F, typename = void>
+struct has_batch_eval : std::false_type
+{
+};
+
+template <typename F>
+struct has_batch_eval<F, std::void_t<decltype(std::declval<const F &>().eval((const double *)0, (double *)0, (size_t)0))>>
+    : std::true_type
+{
+};
+
+#define INTEGRATE_BATCH 256
+
+template <typename Func>
+double integrate_range(const Func &func, double a, double h, long lb, long ub)
+{
+    double sum = 0.0;
+    if constexpr (has_batch_eval<Func>::value)
+    {
+        double x[INTEGRATE_BATCH], y[INTEGRATE_BATCH];
+        for (long i = lb; i < ub; i += INTEGRATE_BATCH)
+        {
+            int count = ub - i < INTEGRATE_BATCH ? ub - i : INTEGRATE_BATCH;
+            double x0 = a + h * (i + 0.5);
+#pragma omp simd
+            for (int k = 0; k < count; k++)
+                x[k] = x0 + h * k;
+            func.eval(x, y, count);
+#pragma omp simd reduction(+ : sum)
+            for (int k = 0; k < count; k++)
+                sum += y[k];
+        }
+    }
+    else
+    {
+#pragma omp simd reduction(+ : sum)
+        for (long i = lb; i < ub; i++)
+            sum += func(a + h * (i + 0.5));
+    }
+    return sum;
+}
+
+// Same midpoint rule as integrate_omp, with the integrand as a template
+// parameter so the call inlines instead of going through a pointer.
+template <typename Func>
+double integrate(const Func &func, double a, double b, long n, size_t num_threads)
+{
+    double h = (b - a) / n;
+    double sum = 0.0;
+#pragma omp parallel num_threads(num_threads) reduction(+ : sum)
+    {
+        long nthreads = omp_get_num_threads();
+        long threadid = omp_get_thread_num();
+        long items_per_thread = n / nthreads;
+        long lb = threadid * items_per_thread;
+        long ub = (threadid == nthreads - 1) ? n : (lb + items_per_thread);
+        sum += integrate_range(func, a, h, lb, ub);
+    }
+    return sum * h;
+}
+
+// One integral of a batch: the midpoint rule with n steps over [a, b] of
+// func(params, x).
+template <typename Params>
+struct integral_task
+{
+    Params params;
+    double a, b;
+    long n;
+};
+
+// integrals longer than this are split, shorter ones are one work item
+#define BATCH_CHUNK_STEPS 4096
+
+// Integrates every task in one parallel region. Work items are whole small
+// integrals and BATCH_CHUNK_STEPS pieces of large ones, handed out
+// dynamically; the pieces of an integral are summed in order afterwards, so
+// results do not depend on the thread count.
+template <typename Func, typename Params>
+void integrate_batch(const Func &func, const integral_task<Params> *tasks, size_t count, double *results,
+                     size_t num_threads)
+{
+    std::vector<size_t> first_chunk(count + 1);
+    first_chunk[0] = 0;
+    for (size_t i = 0; i < count; i++)
+        first_chunk[i + 1] = first_chunk[i] + (tasks[i].n + BATCH_CHUNK_STEPS - 1) / BATCH_CHUNK_STEPS;
+    size_t num_chunks = first_chunk[count];
+    std::vector<double> partial(num_chunks);
+
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 16)
+    for (size_t c = 0; c < num_chunks; c++)
+    {
+        size_t task = std::upper_bound(first_chunk.begin(), first_chunk.end(), c) - first_chunk.begin() - 1;
+        const integral_task<Params> &t = tasks[task];
+        double h = (t.b - t.a) / t.n;
+        long lb = (long)(c - first_chunk[task]) * BATCH_CHUNK_STEPS;
+        long ub = lb + BATCH_CHUNK_STEPS < t.n ? lb + BATCH_CHUNK_STEPS : t.n;
+        double sum = 0.0;
+#pragma omp simd reduction(+ : sum)
+        for (long i = lb; i < ub; i++)
+            sum += func(t.params, t.a + h * (i + 0.5));
+        partial[c] = sum * h;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        double sum = 0.0;
+        for (size_t c = first_chunk[i]; c < first_chunk[i + 1]; c++)
+            sum += partial[c];
+        results[i] = sum;
+    }
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <omp.h>
+#include <cmath>
+#include "integration.hpp"
+#include "qmc.hpp"
+
+#define NUM_THREADS 8
+
+#define DIMS 6
+#define POINTS (1 << 20)
+#define REPLICAS 16
+#define SEED 12345
+
+double cpuSecond()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ((double)ts.tv_sec + (double)ts.tv_nsec * 1.e-9);
+}
+
+// exp(-|x|^2) over the unit cube, the integral is (sqrt(pi) / 2 * erf(1))^dims
+struct gauss_nd
+{
+    int dims;
+
+    void eval(const double *x, double *y, size_t count) const
+    {
+#pragma omp simd
+        for (size_t k = 0; k < count; k++)
+            y[k] = 0.0;
+        for (int d = 0; d < dims; d++)
+        {
+            const double *xd = x + (size_t)d * QMC_BLOCK;
+#pragma omp simd
+            for (size_t k = 0; k < count; k++)
+                y[k] += xd[k] * xd[k];
+        }
+#pragma omp simd
+        for (size_t k = 0; k < count; k++)
+            y[k] = simd_exp(-y[k]);
+    }
+};
+
+// usage: integration_nd.exe [dims] [points] [replicas] [sobol|mc] [seed]
+int main(int argc, char *argv[])
+{
+    size_t num_threads = NUM_THREADS;
+
+    int dims = DIMS;
+    if (argc > 1)
+        dims = atoi(argv[1]);
+    if (dims < 1 || dims > QMC_MAX_DIM)
+    {
+        fprintf(stderr, "dims must be in 1..%d\n", QMC_MAX_DIM);
+        return 1;
+    }
+
+    long points = POINTS;
+    if (argc > 2)
+        points = atol(argv[2]);
+
+    int replicas = REPLICAS;
+    if (argc > 3)
+        replicas = atoi(argv[3]);
+
+    qmc_mode mode = QMC_SOBOL;
+    if (argc > 4 && strcmp(argv[4], "mc") == 0)
+        mode = QMC_MONTE_CARLO;
+
+    uint64_t seed = SEED;
+    if (argc > 5)
+        seed = strtoull(argv[5], NULL, 10);
+
+    gauss_nd func = {dims};
+    double exact = pow(sqrt(M_PI) / 2.0 * erf(1.0), dims);
+
+    double t = cpuSecond();
+    qmc_result res = integrate_qmc(func, dims, points, replicas, mode, seed, num_threads);
+    t = cpuSecond() - t;
+
+    printf("Elapsed time (%s, %d dims, %ld x %d points): %.15f %.6f sec.\n", mode == QMC_SOBOL ? "sobol" : "mc", dims,
+           points, replicas, res.value, t);
+    printf("Standard error %e, actual error %e\n", res.std_error, fabs(res.value - exact));
+
+    double t_serial = cpuSecond();
+    qmc_result serial = integrate_qmc(func, dims, points, replicas, mode, seed, 1);
+    t_serial = cpuSecond() - t_serial;
+
+    printf("Elapsed time (1 thread): %.6f sec. speedup %.3f, %s\n", t_serial, t_serial / t,
+           memcmp(&serial, &res, sizeof(res)) == 0 ? "identical result" : "RESULT DIFFERS");
+
+    return 0;
+}
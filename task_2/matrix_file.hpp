@@ -0,0 +1,234 @@
+#pragma once
+
+// Binary matrix file shared by dgemv.cpp and the SLE solvers.
+//
+// layout: 4096-byte header, then rows * cols doubles in row-major order.
+// The header stores 64-bit sizes and a tag naming the generator, so a file
+// written by one program is never mistaken for another program's matrix.
+// `complete` is set only after the data is written, so an interrupted
+// generation is redone on the next start.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define MATRIX_MAGIC "DMATRIX1"
+#define MATRIX_HEADER_SIZE 4096
+#define PANEL_ROWS 256
+
+struct matrix_header
+{
+    char magic[8];
+    char tag[16];
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t complete;
+};
+
+typedef void (*matrix_fill_func)(double *matrix, size_t m, size_t n);
+
+inline size_t matrix_file_size(size_t m, size_t n)
+{
+    return MATRIX_HEADER_SIZE + m * n * sizeof(double);
+}
+
+inline int matrix_file_valid(int fd, const char *tag, size_t m, size_t n)
+{
+    struct matrix_header h;
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+        return 0;
+    return memcmp(h.magic, MATRIX_MAGIC, 8) == 0 && strncmp(h.tag, tag, sizeof(h.tag)) == 0 &&
+           h.rows == m && h.cols == n && h.complete == 1;
+}
+
+// Makes sure `path` holds the m x n matrix produced by `fill`, generating it
+// only when the cached file is missing or does not match. Returns 1 if the
+// matrix was regenerated, 0 on a cache hit and -1 on error.
+inline int prepare_matrix_file(const char *path, const char *tag, size_t m, size_t n, matrix_fill_func fill)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    if (matrix_file_valid(fd, tag, m, n))
+    {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = matrix_file_size(m, n);
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    char *map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    fill((double *)(map + MATRIX_HEADER_SIZE), m, n);
+
+    struct matrix_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MATRIX_MAGIC, 8);
+    strncpy(h.tag, tag, sizeof(h.tag) - 1);
+    h.rows = m;
+    h.cols = n;
+    memcpy(map, &h, sizeof(h));
+    msync(map, size, MS_SYNC);
+
+    h.complete = 1;
+    memcpy(map, &h, sizeof(h));
+    msync(map, MATRIX_HEADER_SIZE, MS_SYNC);
+
+    munmap(map, size);
+    close(fd);
+    return 1;
+}
+
+// Read-only mapping of the matrix data. The kernel reads ahead sequentially
+// and drops clean pages under memory pressure, so the matrix may exceed RAM.
+inline double *map_matrix_file(const char *path, size_t m, size_t n)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+    size_t size = matrix_file_size(m, n);
+    char *map = (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror(path);
+        return NULL;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    return (double *)(map + MATRIX_HEADER_SIZE);
+}
+
+inline void unmap_matrix_file(double *matrix, size_t m, size_t n)
+{
+    munmap((char *)matrix - MATRIX_HEADER_SIZE, matrix_file_size(m, n));
+}
+
+inline int read_panel(int fd, double *panel, size_t first_row, size_t rows, size_t n)
+{
+    char *dst = (char *)panel;
+    size_t left = rows * n * sizeof(double);
+    off_t offset = MATRIX_HEADER_SIZE + (off_t)(first_row * n * sizeof(double));
+    while (left > 0)
+    {
+        ssize_t got = pread(fd, dst, left, offset);
+        if (got <= 0)
+            return 0;
+        dst += got;
+        offset += got;
+        left -= got;
+    }
+    return 1;
+}
+
+// Streams the matrix file in panels of PANEL_ROWS rows. One reader thread
+// fills the two panel buffers in turn while `compute` works on the other
+// one, so only two panels are ever resident. compute(panel, first_row, rows)
+// is called in row order.
+template <typename Func>
+int stream_matrix_file(const char *path, size_t m, size_t n, Func compute)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return 0;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    double *panels[2];
+    panels[0] = (double *)malloc(PANEL_ROWS * n * sizeof(double));
+    panels[1] = (double *)malloc(PANEL_ROWS * n * sizeof(double));
+    if (panels[0] == NULL || panels[1] == NULL)
+    {
+        perror(path);
+        free(panels[0]);
+        free(panels[1]);
+        close(fd);
+        return 0;
+    }
+    size_t num_panels = (m + PANEL_ROWS - 1) / PANEL_ROWS;
+
+    // filled[b]: panel buffer b holds data compute has not used yet
+    std::mutex mut;
+    std::condition_variable changed;
+    int filled[2] = {0, 0};
+    int ok = 1;
+    int stop = 0;
+
+    std::thread reader(
+        [&]()
+        {
+            for (size_t p = 0; p < num_panels; p++)
+            {
+                int b = p & 1;
+                {
+                    std::unique_lock<std::mutex> lock(mut);
+                    changed.wait(lock, [&]() { return !filled[b] || stop; });
+                    if (stop)
+                        return;
+                }
+                size_t first = p * PANEL_ROWS;
+                size_t rows = m - first < PANEL_ROWS ? m - first : PANEL_ROWS;
+                int got = read_panel(fd, panels[b], first, rows, n);
+                std::lock_guard<std::mutex> lock(mut);
+                if (got)
+                    filled[b] = 1;
+                else
+                    ok = 0;
+                changed.notify_all();
+                if (!got)
+                    return;
+            }
+        });
+
+    for (size_t p = 0; p < num_panels; p++)
+    {
+        int b = p & 1;
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            changed.wait(lock, [&]() { return filled[b] || !ok; });
+            if (!filled[b])
+                break;
+        }
+        size_t first = p * PANEL_ROWS;
+        compute(panels[b], first, m - first < PANEL_ROWS ? m - first : PANEL_ROWS);
+        std::lock_guard<std::mutex> lock(mut);
+        filled[b] = 0;
+        changed.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        stop = 1;
+        changed.notify_all();
+    }
+    reader.join();
+
+    free(panels[0]);
+    free(panels[1]);
+    close(fd);
+    return ok;
+}
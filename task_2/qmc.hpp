@@ -0,0 +1,194 @@
+#pragma once
+
+// Multidimensional integration over the unit cube by quasi-Monte Carlo
+// (Sobol points) or plain Monte Carlo.
+//
+// Points are numbered globally and cut into blocks of QMC_BLOCK. Every block
+// computes its points directly from its start index (Sobol skip-ahead, or a
+// counter-based generator for Monte Carlo), so any thread can take any block
+// and gets exactly the points a serial run would. Block sums are added in
+// block order after the parallel loop, which makes the result bit-identical
+// for every thread count at a fixed seed.
+//
+// The error estimate comes from independent replicas: Sobol replicas use a
+// random digital shift, Monte Carlo replicas use separate streams.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+#include <vector>
+
+#define QMC_BLOCK 1024
+#define QMC_MAX_DIM 10
+#define SOBOL_BITS 32
+
+enum qmc_mode
+{
+    QMC_SOBOL,
+    QMC_MONTE_CARLO
+};
+
+struct qmc_result
+{
+    double value;
+    double std_error;
+    long evaluations;
+};
+
+// primitive polynomials and initial direction numbers for dimensions 2..10
+// (Joe & Kuo, new-joe-kuo-6.21201); dimension 1 is the van der Corput sequence
+struct sobol_poly
+{
+    int degree;
+    unsigned coeffs;
+    unsigned m[5];
+};
+
+static const sobol_poly sobol_polys[QMC_MAX_DIM - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+};
+
+struct sobol_directions
+{
+    uint32_t v[QMC_MAX_DIM][SOBOL_BITS];
+
+    explicit sobol_directions(int dims)
+    {
+        for (int i = 0; i < SOBOL_BITS; i++)
+            v[0][i] = 1u << (SOBOL_BITS - 1 - i);
+        for (int d = 1; d < dims; d++)
+        {
+            const sobol_poly &p = sobol_polys[d - 1];
+            int s = p.degree;
+            for (int i = 0; i < s; i++)
+                v[d][i] = p.m[i] << (SOBOL_BITS - 1 - i);
+            for (int i = s; i < SOBOL_BITS; i++)
+            {
+                v[d][i] = v[d][i - s] ^ (v[d][i - s] >> s);
+                for (int k = 1; k < s; k++)
+                    v[d][i] ^= ((p.coeffs >> (s - 1 - k)) & 1) * v[d][i - k];
+            }
+        }
+    }
+
+    // point `index` in Gray-code order, computed without its predecessors
+    uint32_t point(int d, uint64_t index) const
+    {
+        uint64_t gray = index ^ (index >> 1);
+        uint32_t x = 0;
+        for (int i = 0; gray != 0; i++, gray >>= 1)
+            if (gray & 1)
+                x ^= v[d][i];
+        return x;
+    }
+};
+
+// SplitMix64 finalizer; hashing (seed, stream, counter) gives a generator
+// with no state, so a block's numbers only depend on its point indices
+inline uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t counter_random(uint64_t seed, uint64_t stream, uint64_t counter)
+{
+    return mix64(mix64(seed ^ (stream * 0x9e3779b97f4a7c15ull)) + counter * 0x9e3779b97f4a7c15ull);
+}
+
+// fills x[d * QMC_BLOCK + k] with coordinate d of point first + k
+inline void qmc_block_points(const sobol_directions &sobol, qmc_mode mode, int dims, uint64_t seed,
+                             int replica, const uint32_t *shift, uint64_t first, int count, double *x)
+{
+    const double scale = 1.0 / 4294967296.0;
+    for (int d = 0; d < dims; d++)
+    {
+        double *xd = x + (size_t)d * QMC_BLOCK;
+        if (mode == QMC_SOBOL)
+        {
+            // skip ahead to the block start, then step: in Gray-code order
+            // point n + 1 differs from point n by one direction number
+            uint32_t p = sobol.point(d, first);
+            for (int k = 0; k < count; k++)
+            {
+                xd[k] = (p ^ shift[d]) * scale;
+                p ^= sobol.v[d][__builtin_ctzll(first + k + 1)];
+            }
+        }
+        else
+        {
+            uint64_t stream = (uint64_t)replica * QMC_MAX_DIM + d;
+#pragma omp simd
+            for (int k = 0; k < count; k++)
+                xd[k] = (uint32_t)(counter_random(seed, stream, first + k) >> 32) * scale;
+        }
+    }
+}
+
+// Integrates func over [0, 1)^dims with `points` points in each of
+// `replicas` randomized replicas. func.eval(x, y, count) gets coordinate d of
+// point k at x[d * QMC_BLOCK + k].
+template <typename Func>
+qmc_result integrate_qmc(const Func &func, int dims, long points, int replicas, qmc_mode mode, uint64_t seed,
+                         size_t num_threads)
+{
+    sobol_directions sobol(dims);
+    std::vector<uint32_t> shifts((size_t)replicas * dims);
+    for (int r = 0; r < replicas; r++)
+        for (int d = 0; d < dims; d++)
+            shifts[(size_t)r * dims + d] = (uint32_t)counter_random(seed, ~(uint64_t)r, d);
+
+    long blocks = (points + QMC_BLOCK - 1) / QMC_BLOCK;
+    std::vector<double> block_sums((size_t)replicas * blocks);
+
+#pragma omp parallel num_threads(num_threads)
+    {
+        double *x = (double *)malloc((size_t)dims * QMC_BLOCK * sizeof(double));
+        double *y = (double *)malloc(QMC_BLOCK * sizeof(double));
+#pragma omp for schedule(dynamic)
+        for (long job = 0; job < replicas * blocks; job++)
+        {
+            int r = job / blocks;
+            uint64_t first = (uint64_t)(job % blocks) * QMC_BLOCK;
+            int count = points - (long)first < QMC_BLOCK ? points - first : QMC_BLOCK;
+            qmc_block_points(sobol, mode, dims, seed, r, &shifts[(size_t)r * dims], first, count, x);
+            func.eval(x, y, count);
+            double sum = 0.0;
+#pragma omp simd reduction(+ : sum)
+            for (int k = 0; k < count; k++)
+                sum += y[k];
+            block_sums[job] = sum;
+        }
+        free(x);
+        free(y);
+    }
+
+    double mean = 0.0, sq = 0.0;
+    for (int r = 0; r < replicas; r++)
+    {
+        double sum = 0.0;
+        for (long blk = 0; blk < blocks; blk++)
+            sum += block_sums[(size_t)r * blocks + blk];
+        double estimate = sum / points;
+        // Welford update keeps the variance stable for many replicas
+        double delta = estimate - mean;
+        mean += delta / (r + 1);
+        sq += delta * (estimate - mean);
+    }
+
+    qmc_result res;
+    res.value = mean;
+    res.std_error = replicas > 1 ? sqrt(sq / (replicas - 1) / replicas) : 0.0;
+    res.evaluations = points * replicas;
+    return res;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+// Simple iteration solver and its vector kernels, shared by SLE2.cpp and
+// benchmark.cpp. Programs that fix the team size define NUM_THREADS before
+// including this header, otherwise the OpenMP default applies.
+
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+
+#ifndef NUM_THREADS
+#define NUM_THREADS omp_get_max_threads()
+#endif
+
+inline void init_matrix(double *matrix, int n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            if (i == j)
+                matrix[(size_t)i * n + j] = 2.0;
+            else
+                matrix[(size_t)i * n + j] = 1.0;
+        }
+    }
+}
+
+template <typename T, typename V>
+void convert_vector(const T *src, V *dst, size_t n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (size_t i = 0; i < n; i++)
+    {
+        dst[i] = (V)src[i];
+    }
+}
+
+// products are accumulated in double whatever the storage type
+template <typename T>
+void matrix_vector_product(T *mx, T *vec, T *res, int n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (int i = 0; i < n; i++)
+    {
+        double sum = 0;
+        for (int j = 0; j < n; j++)
+        {
+            sum += mx[(size_t)i * n + j] * vec[j];
+        }
+        res[i] = sum;
+    }
+}
+
+template <typename T>
+void vector_sub(T *vec_1, T *vec_2, T *res, int n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (int i = 0; i < n; i++)
+    {
+        res[i] = vec_1[i] - vec_2[i];
+    }
+}
+
+template <typename T>
+void inplace_vector_sub(T *vec_1, T *vec_2, int n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (int i = 0; i < n; i++)
+    {
+        vec_1[i] -= vec_2[i];
+    }
+}
+
+template <typename T>
+void vector_scalar_product(T *vec, T scale, int n)
+{
+#pragma omp parallel for num_threads(NUM_THREADS)
+    for (int i = 0; i < n; i++)
+    {
+        vec[i] *= scale;
+    }
+}
+
+template <typename T>
+double find_norm(T *vec, int n)
+{
+    double norm = 0;
+#pragma omp parallel for num_threads(NUM_THREADS) reduction(+ : norm)
+    for (int i = 0; i < n; i++)
+    {
+        norm += (double)vec[i] * vec[i];
+    }
+    return sqrt(norm);
+}
+
+template <typename T>
+int simple_iteration(T *matrix, T *x, T *b, int n, T tau, double eps, int max_iterations)
+{
+    T *ax = (T *)malloc(n * sizeof(T));
+    T *subs = (T *)malloc(n * sizeof(T));
+    double norm_b = find_norm(b, n);
+    double norm_sub;
+    int iterations = 0;
+
+    while (iterations < max_iterations)
+    {
+        matrix_vector_product(matrix, x, ax, n);
+        vector_sub(ax, b, subs, n);
+        norm_sub = find_norm(subs, n);
+        if (norm_sub / norm_b < eps)
+            break;
+        vector_scalar_product(subs, tau, n);
+        inplace_vector_sub(x, subs, n);
+        iterations++;
+    }
+
+    free(ax);
+    free(subs);
+    return iterations;
+}